@@ -34,6 +34,10 @@ class _SmartLEDHomePageState extends State<SmartLEDHomePage> {
   late IOWebSocketChannel _channel;
   bool _connected = false;
   bool _ledOn = false;
+  // Epoch of the last sync and the last state version seen, presented when
+  // reconnecting to be sent only the changes missed in between.
+  int? _epoch;
+  int? _stateVersion;
 
   Future<String?> getAddress(BuildContext context) {
     return showDialog<String>(
@@ -73,7 +77,16 @@ class _SmartLEDHomePageState extends State<SmartLEDHomePage> {
     }
     log("Connecting to $address.");
     try {
-      _channel = IOWebSocketChannel.connect(address);
+      Uri uri = Uri.parse(address);
+      if (_epoch != null && _stateVersion != null) {
+        uri = uri.replace(
+            path: uri.path.isEmpty ? "/" : uri.path,
+            queryParameters: {
+              "epoch": "$_epoch",
+              "version": "$_stateVersion",
+            });
+      }
+      _channel = IOWebSocketChannel.connect(uri);
       _channel.stream.listen(onData, onError: onError);
       log("Connected succesfully.");
       _connected = true;
@@ -83,11 +96,39 @@ class _SmartLEDHomePageState extends State<SmartLEDHomePage> {
     }
   }
 
+  int readUint32(List<int> data, int offset) {
+    return data[offset] << 24 |
+        data[offset + 1] << 16 |
+        data[offset + 2] << 8 |
+        data[offset + 3];
+  }
+
   void onData(dynamic message) {
     List<int> data = message;
+    // A sync message (version, 0x82, epoch, state version, count, snapshot)
+    // announces the state messages that bring this client up to date.
+    if (data.length >= 12 && data[1] == 0x82) {
+      _epoch = readUint32(data, 2);
+      int count = data[10];
+      log(data[11] != 0
+          ? "Received state snapshot."
+          : "Catching up on $count missed changes.");
+      return;
+    }
+    // Either a bare on/off byte or a state message: version, 0x81, on, ...,
+    // state version.
+    bool? on;
     if (data.length == 1) {
+      on = data[0] != 0;
+    } else if (data.length >= 3 && data[1] == 0x81) {
+      on = data[2] != 0;
+      if (data.length >= 14) {
+        _stateVersion = readUint32(data, 10);
+      }
+    }
+    if (on != null) {
       setState(() {
-        _ledOn = data[0] != 0;
+        _ledOn = on!;
       });
       String state = _ledOn ? "on" : "off";
       log("Received LED state: $state.");
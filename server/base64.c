@@ -0,0 +1,25 @@
+#include <stdint.h>
+
+#include "base64.h"
+
+static const char alphabet[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64_encode(char *dst, const void *src, size_t length) {
+  const uint8_t *p = src;
+  char *out = dst;
+  for (; length >= 3; length -= 3, p += 3) {
+    uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    *out++ = alphabet[v >> 18];
+    *out++ = alphabet[(v >> 12) & 63];
+    *out++ = alphabet[(v >> 6) & 63];
+    *out++ = alphabet[v & 63];
+  }
+  if (length > 0) {
+    uint32_t v = (uint32_t)p[0] << 16 | (length > 1 ? (uint32_t)p[1] << 8 : 0);
+    *out++ = alphabet[v >> 18];
+    *out++ = alphabet[(v >> 12) & 63];
+    *out++ = length > 1 ? alphabet[(v >> 6) & 63] : '=';
+    *out++ = '=';
+  }
+  return out - dst;
+}
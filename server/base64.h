@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+
+// Size of the base64 encoding of length bytes, without a terminator.
+#define BASE64_ENCODED_SIZE(length) (((length) + 2) / 3 * 4)
+
+// Encodes length bytes from src into dst, padded with '='. Returns the number
+// of characters written; no terminator is added.
+size_t base64_encode(char *dst, const void *src, size_t length);
@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "pico/time.h"
+
+#include "connection.h"
+
+#define ITERATIONS 200000
+#define WS_FIN (1 << 7)
+#define WS_OP_BINARY 0x02
+
+static struct tcp_pcb pcbs[MAX_CONNECTIONS];
+static unsigned char ws_frame[3] = {WS_FIN | WS_OP_BINARY, 1, 0};
+
+static void setup(size_t clients) {
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+    if (connections[i].state != FREE)
+      connection_release(&connections[i]);
+  }
+  for (size_t i = 0; i < clients; ++i) {
+    struct Connection *connection = connection_alloc(&pcbs[i]);
+    connection->state = ONLINE;
+  }
+}
+
+static void ack_all(size_t clients) {
+  for (size_t i = 0; i < clients; ++i)
+    tcp_stub_ack(&pcbs[i]);
+}
+
+// The previous approach: format the frame again for every client.
+static void per_client_copy(bool on) {
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+    struct Connection *connection = &connections[i];
+    if (connection->state != ONLINE)
+      continue;
+    unsigned char frame[3] = {WS_FIN | WS_OP_BINARY, 1, on};
+    tcp_write(connection->pcb, frame, sizeof(frame), TCP_WRITE_FLAG_COPY);
+    tcp_output(connection->pcb);
+  }
+}
+
+static void single_encode(bool on) {
+  ws_frame[2] = on;
+  connection_broadcast(ws_frame, sizeof(ws_frame));
+}
+
+static double run(size_t clients, void (*send)(bool)) {
+  setup(clients);
+  // time_us_64 only has microsecond resolution so the whole run is timed. The
+  // acknowledgement stand-in is cheap and identical for both variants.
+  uint64_t start = time_us_64();
+  for (size_t i = 0; i < ITERATIONS; ++i) {
+    send(i & 1);
+    ack_all(clients);
+  }
+  return (double)(time_us_64() - start) * 1000.0 / ITERATIONS;
+}
+
+int main(void) {
+  static const size_t client_counts[] = {1, 4, 8};
+  printf("%-8s %20s %20s\n", "clients", "per-client copy ns", "single encode ns");
+  for (size_t i = 0; i < sizeof(client_counts) / sizeof(client_counts[0]); ++i) {
+    size_t clients = client_counts[i];
+    double copy_ns = run(clients, per_client_copy);
+    double single_ns = run(clients, single_encode);
+    printf("%-8zu %20.1f %20.1f\n", clients, copy_ns, single_ns);
+  }
+  return 0;
+}
@@ -0,0 +1,210 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "pico/time.h"
+#if PICO_ON_DEVICE
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#endif
+
+#include "http.h"
+
+#define ITERATIONS 2000
+#define REQUEST_BUF_SIZE 512
+
+// A browser handshake followed by a masked frame the client sent without
+// waiting for the response.
+static const char handshake[] =
+  "GET / HTTP/1.1\r\n"
+  "Host: 192.168.1.23\r\n"
+  "Connection: keep-alive, Upgrade\r\n"
+  "Pragma: no-cache\r\n"
+  "Cache-Control: no-cache\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+  "Upgrade: websocket\r\n"
+  "Origin: http://192.168.1.23\r\n"
+  "Sec-WebSocket-Version: 13\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Accept-Language: en-GB,en;q=0.9,fi;q=0.8\r\n"
+  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+  "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+  "\r\n"
+  "\x82\x81\x01\x02\x03\x04\x00";
+#define FRAME_SIZE 7
+
+static char request_buf[REQUEST_BUF_SIZE];
+static char copy_buf[sizeof(handshake)];
+static volatile size_t sink;
+
+// Feeds the handshake in pieces of at most piece bytes, the first one split
+// bytes long. Returns the number of bytes left over for the frame decoder.
+static size_t feed(size_t length, size_t split, size_t piece) {
+  struct HttpParser parser;
+  http_parser_init(&parser, request_buf, sizeof(request_buf));
+  size_t offset = 0;
+  while (offset < length) {
+    size_t n = offset == 0 && split ? split : piece;
+    if (n > length - offset)
+      n = length - offset;
+    size_t consumed;
+    const struct HttpRequest *request;
+    int status = http_parse(&parser, &handshake[offset], n, &consumed, &request);
+    offset += consumed;
+    if (status == HTTP_PARSE_DONE) {
+      if (!request->upgrade_websocket || request->websocket_key_length != 24
+          || memcmp(request->websocket_key, "dGhlIHNhbXBsZSBub25jZQ==", 24)) {
+        printf("Wrong request for split %zu, piece %zu.\n", split, piece);
+        exit(1);
+      }
+      sink += request->websocket_key_length;
+      return length - offset;
+    }
+    if (status != HTTP_PARSE_INCOMPLETE) {
+      printf("Parse error %d for split %zu, piece %zu.\n", status, split, piece);
+      exit(1);
+    }
+  }
+  printf("Incomplete for split %zu, piece %zu.\n", split, piece);
+  exit(1);
+}
+
+// Previous approach, with the terminator search fixed to cover segment
+// boundaries: copy every segment into the request buffer, search all of it
+// again, then walk the header lines of the complete head.
+static size_t feed_rescan(size_t length, size_t split, size_t piece) {
+  size_t buffered = 0;
+  while (buffered < length) {
+    size_t n = buffered == 0 && split ? split : piece;
+    if (n > length - buffered)
+      n = length - buffered;
+    memcpy(&copy_buf[buffered], &handshake[buffered], n);
+    buffered += n;
+    const char *head_end = memmem(copy_buf, buffered, "\r\n\r\n", 4);
+    if (!head_end)
+      continue;
+
+    const char *key = NULL;
+    const char *line = memmem(copy_buf, head_end + 2 - copy_buf, "\r\n", 2) + 2;
+    while (line < head_end + 2) {
+      const char *line_end = memmem(line, head_end + 2 - line, "\r\n", 2);
+      const char *colon = memchr(line, ':', line_end - line);
+      size_t name_length = colon - line;
+      if (name_length == 17 && !strncasecmp(line, "sec-websocket-key", 17))
+        key = colon + 2;
+      else if (name_length == 10 && !strncasecmp(line, "connection", 10))
+        sink += line_end - colon;
+      else if (name_length == 7 && !strncasecmp(line, "upgrade", 7))
+        sink += line_end - colon;
+      line = line_end + 2;
+    }
+    sink += key != NULL;
+    return buffered - (head_end + 4 - copy_buf);
+  }
+  return 0;
+}
+
+// Parses a whole request. Returns the status, and the request if it is done.
+static int parse(const char *data, size_t length, const struct HttpRequest **request) {
+  static struct HttpParser parser;
+  http_parser_init(&parser, request_buf, sizeof(request_buf));
+  size_t consumed;
+  return http_parse(&parser, data, length, &consumed, request);
+}
+
+// Header names are made of token characters only, and one that runs past a
+// known name must not match it.
+static bool check_header_names(void) {
+  static const char nul[] = "GET / HTTP/1.1\r\nupgrade\0xyz: websocket\r\n\r\n";
+  static const char nul_unknown[] = "GET / HTTP/1.1\r\nx-unknown\0: 1\r\n\r\n";
+  static const char space[] = "GET / HTTP/1.1\r\nConnection : close\r\n\r\n";
+  static const char longer[] = "GET / HTTP/1.1\r\nConnectionX: close\r\n\r\n";
+  const struct HttpRequest *request;
+  if (parse(nul, sizeof(nul) - 1, &request) != HTTP_PARSE_ERROR
+      || parse(nul_unknown, sizeof(nul_unknown) - 1, &request) != HTTP_PARSE_ERROR
+      || parse(space, sizeof(space) - 1, &request) != HTTP_PARSE_ERROR) {
+    printf("Invalid header name accepted.\n");
+    return false;
+  }
+  if (parse(longer, sizeof(longer) - 1, &request) != HTTP_PARSE_DONE || !request->keep_alive) {
+    printf("Longer header name matched a known one.\n");
+    return false;
+  }
+  return true;
+}
+
+typedef size_t (*feed_fn)(size_t length, size_t split, size_t piece);
+
+// Average time per handshake over every split point of a two piece delivery.
+static double run_splits(feed_fn fn, size_t length) {
+  uint64_t start = time_us_64();
+  size_t runs = 0;
+  for (size_t i = 0; i < ITERATIONS / 10; ++i) {
+    for (size_t split = 1; split < length; ++split, ++runs)
+      fn(length, split, length);
+  }
+  return (double)(time_us_64() - start) * 1000.0 / runs;
+}
+
+static double run(feed_fn fn, size_t length, size_t piece) {
+  uint64_t start = time_us_64();
+  for (size_t i = 0; i < ITERATIONS; ++i)
+    fn(length, 0, piece);
+  return (double)(time_us_64() - start) * 1000.0 / ITERATIONS;
+}
+
+int main(void) {
+#if PICO_ON_DEVICE
+  stdio_init_all();
+  sleep_ms(2000);
+  double cycles_per_us = clock_get_hz(clk_sys) / 1e6;
+#endif
+  size_t length = sizeof(handshake) - 1;
+
+  // Every split point must give the same request and leave the frame over.
+  for (size_t split = 1; split < length; ++split) {
+    if (feed(length, split, length) != FRAME_SIZE) {
+      printf("Leftover bytes lost for split %zu.\n", split);
+      return 1;
+    }
+  }
+  for (size_t piece = 1; piece <= 64; ++piece) {
+    if (feed(length, 0, piece) != FRAME_SIZE) {
+      printf("Leftover bytes lost for pieces of %zu.\n", piece);
+      return 1;
+    }
+  }
+  printf("%zu byte handshake, every split point parsed correctly.\n", length - FRAME_SIZE);
+  if (!check_header_names())
+    return 1;
+
+  struct {
+    const char *name;
+    feed_fn fn;
+  } parsers[] = {
+    {"incremental", feed},
+    {"copy, rescan", feed_rescan},
+  };
+  printf("%-14s %-16s %14s\n", "parser", "delivery", "ns/handshake");
+  for (size_t i = 0; i < sizeof(parsers) / sizeof(parsers[0]); ++i) {
+    struct {
+      const char *name;
+      double ns;
+    } results[] = {
+      {"whole", run(parsers[i].fn, length, length)},
+      {"every split", run_splits(parsers[i].fn, length)},
+      {"536 byte MSS", run(parsers[i].fn, length, 536)},
+      {"byte at a time", run(parsers[i].fn, length, 1)},
+    };
+    for (size_t j = 0; j < sizeof(results) / sizeof(results[0]); ++j) {
+      printf("%-14s %-16s %14.1f", parsers[i].name, results[j].name, results[j].ns);
+#if PICO_ON_DEVICE
+      printf(" (%.0f cycles)", results[j].ns * cycles_per_us / 1000.0);
+#endif
+      printf("\n");
+    }
+  }
+  return 0;
+}
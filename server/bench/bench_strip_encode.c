@@ -0,0 +1,34 @@
+#include <stdio.h>
+
+#include "pico/time.h"
+
+#include "strip_encode.h"
+
+#define ITERATIONS 2000
+#define PIXELS 1000
+
+static struct Pixel pixels[PIXELS];
+static uint32_t words[PIXELS];
+
+static double run(enum StripFormat format) {
+  uint64_t start = time_us_64();
+  for (size_t i = 0; i < ITERATIONS; ++i)
+    strip_encode(words, pixels, PIXELS, format, i);
+  return (double)(time_us_64() - start) / ITERATIONS;
+}
+
+int main(void) {
+  for (size_t i = 0; i < PIXELS; ++i)
+    pixels[i] = (struct Pixel){i, i >> 2, 255 - i, i * 7};
+
+  printf("%-8s %14s\n", "format", "us/1000 px");
+  printf("%-8s %14.2f\n", "GRB", run(STRIP_GRB));
+  printf("%-8s %14.2f\n", "GRBW", run(STRIP_GRBW));
+
+  // The first pixel at full brightness must come out as G, R, B(, W) with the
+  // most significant byte first.
+  pixels[0] = (struct Pixel){255, 0, 255, 0};
+  strip_encode(words, pixels, 1, STRIP_GRB, 255);
+  printf("encoded (255, 0, 255): 0x%08x\n", (unsigned)words[0]);
+  return 0;
+}
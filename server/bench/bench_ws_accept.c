@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/time.h"
+#if PICO_ON_DEVICE
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#endif
+
+#include "base64.h"
+#include "sha1.h"
+#include "ws.h"
+
+#define ITERATIONS 20000
+
+static volatile char sink;
+
+static bool check_sha1(const char *input, size_t repeat, const char *expected) {
+  struct Sha1 sha1;
+  uint8_t digest[SHA1_SIZE];
+  char hex[2 * SHA1_SIZE + 1];
+  sha1_init(&sha1);
+  for (size_t i = 0; i < repeat; ++i)
+    sha1_update(&sha1, input, strlen(input));
+  sha1_final(&sha1, digest);
+  for (size_t i = 0; i < SHA1_SIZE; ++i)
+    sprintf(&hex[2 * i], "%02x", digest[i]);
+  if (strcmp(hex, expected)) {
+    printf("SHA-1 mismatch: %s\n", hex);
+    return false;
+  }
+  return true;
+}
+
+static bool check_base64(const char *input, const char *expected) {
+  char output[16];
+  size_t length = base64_encode(output, input, strlen(input));
+  if (length != strlen(expected) || memcmp(output, expected, length)) {
+    printf("base64 mismatch for \"%s\"\n", input);
+    return false;
+  }
+  return true;
+}
+
+int main(void) {
+#if PICO_ON_DEVICE
+  stdio_init_all();
+  sleep_ms(2000);
+  double cycles_per_us = clock_get_hz(clk_sys) / 1e6;
+#endif
+  // FIPS 180 and RFC 4648 test vectors, and the RFC 6455 handshake example.
+  bool ok = check_sha1("abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d")
+            && check_sha1("", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709")
+            && check_sha1("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+                          "84983e441c3bd26ebaae4aa1f95129e5e54670f1")
+            && check_sha1("aaaaaaaaaa", 100000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f")
+            && check_base64("", "") && check_base64("f", "Zg==") && check_base64("fo", "Zm8=")
+            && check_base64("foo", "Zm9v") && check_base64("foobar", "Zm9vYmFy");
+  const char *key = "dGhlIHNhbXBsZSBub25jZQ==";
+  char accept[WS_ACCEPT_SIZE];
+  ws_accept_key(key, strlen(key), accept);
+  if (memcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", WS_ACCEPT_SIZE)) {
+    printf("Wrong accept value: %.*s\n", WS_ACCEPT_SIZE, accept);
+    ok = false;
+  }
+  if (!ok)
+    return 1;
+
+  uint64_t start = time_us_64();
+  for (size_t i = 0; i < ITERATIONS; ++i) {
+    ws_accept_key(key, strlen(key), accept);
+    sink += accept[0];
+  }
+  double ns = (double)(time_us_64() - start) * 1000.0 / ITERATIONS;
+#if WS_MBEDTLS
+  printf("ws_accept_key (mbedTLS): %.1f ns", ns);
+#else
+  printf("ws_accept_key (built-in): %.1f ns", ns);
+#endif
+#if PICO_ON_DEVICE
+  printf(" (%.0f cycles)", ns * cycles_per_us / 1000.0);
+#endif
+  printf("\n");
+  return 0;
+}
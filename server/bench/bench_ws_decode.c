@@ -0,0 +1,97 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/time.h"
+#if PICO_ON_DEVICE
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#endif
+
+#include "ws.h"
+
+#define ITERATIONS 20000
+#define MAX_PAYLOAD 1024
+
+static unsigned char frame[WS_MAX_HEADER_SIZE + MAX_PAYLOAD];
+static unsigned char message_buf[2 * MAX_PAYLOAD];
+static size_t frame_header_length;
+static unsigned char copy_buf[sizeof(frame)];
+static volatile size_t sink;
+
+static bool count_frame(void *arg, unsigned char opcode, unsigned char *payload, size_t length) {
+  sink += length + payload[0];
+  return true;
+}
+
+static size_t build_frame(size_t payload_length) {
+  static const unsigned char mask[4] = {0x37, 0xFA, 0x21, 0x3D};
+  size_t header_length = ws_encode_header(frame, WS_OP_BINARY, payload_length);
+  frame[1] |= WS_MASK;
+  memcpy(&frame[header_length], mask, 4);
+  header_length += 4;
+  frame_header_length = header_length;
+  for (size_t i = 0; i < payload_length; ++i)
+    frame[header_length + i] = (unsigned char)i ^ mask[i & 3];
+  return header_length + payload_length;
+}
+
+// Previous approach: copy the segment into the request buffer and unmask a
+// byte at a time.
+static void copy_bytewise(size_t frame_length) {
+  memcpy(copy_buf, frame, frame_length);
+  size_t header_length = frame_header_length;
+  const unsigned char *mask = &copy_buf[header_length - 4];
+  size_t payload_length = frame_length - header_length;
+  for (size_t i = 0; i < payload_length; ++i)
+    copy_buf[header_length + i] ^= mask[i & 3];
+  count_frame(NULL, WS_OP_BINARY, &copy_buf[header_length], payload_length);
+}
+
+static double run(size_t frame_length, size_t split) {
+  struct WsDecoder decoder;
+  ws_decoder_init(&decoder, message_buf, sizeof(message_buf));
+  uint64_t start = time_us_64();
+  for (size_t i = 0; i < ITERATIONS; ++i) {
+    if (split == SIZE_MAX) {
+      copy_bytewise(frame_length);
+    } else if (split == 0) {
+      ws_decode(&decoder, frame, frame_length, count_frame, NULL);
+    } else {
+      ws_decode(&decoder, frame, split, count_frame, NULL);
+      ws_decode(&decoder, &frame[split], frame_length - split, count_frame, NULL);
+    }
+  }
+  return (double)(time_us_64() - start) * 1000.0 / ITERATIONS;
+}
+
+int main(void) {
+#if PICO_ON_DEVICE
+  stdio_init_all();
+  sleep_ms(2000);
+  double cycles_per_us = clock_get_hz(clk_sys) / 1e6;
+#endif
+  static const size_t payload_lengths[] = {1, 64, 1024};
+  printf("%-8s %-22s %12s\n", "payload", "variant", "ns/frame");
+  for (size_t i = 0; i < sizeof(payload_lengths) / sizeof(payload_lengths[0]); ++i) {
+    size_t frame_length = build_frame(payload_lengths[i]);
+    struct {
+      const char *name;
+      size_t split;
+    } variants[] = {
+      {"copy, bytewise", SIZE_MAX},
+      {"in place", 0},
+      {"header straddles", 1},
+      {"payload straddles", frame_length - 1},
+    };
+    for (size_t j = 0; j < sizeof(variants) / sizeof(variants[0]); ++j) {
+      double ns = run(frame_length, variants[j].split);
+      printf("%-8zu %-22s %12.1f", payload_lengths[i], variants[j].name, ns);
+#if PICO_ON_DEVICE
+      printf(" (%.0f cycles)", ns * cycles_per_us / 1000.0);
+#endif
+      printf("\n");
+    }
+  }
+  return 0;
+}
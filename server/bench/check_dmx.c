@@ -0,0 +1,205 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dmx.h"
+
+// Checks the DMX packet parser and the sequence window on the host: E1.31 and
+// Art-Net headers field by field, universes that are truncated or larger than
+// DMX allows, and late, duplicated and restarted sequence numbers, across the
+// wrap of the 8-bit counter.
+//
+// Exits with status 1 if a check fails.
+
+#define UNIVERSE 7
+#define DMX_SEQUENCE_WINDOW 20
+
+static unsigned checks, failures;
+
+static void check(bool ok, const char *what) {
+  ++checks;
+  if (!ok) {
+    ++failures;
+    printf("FAIL: %s\n", what);
+  }
+}
+
+static void write16(unsigned char *p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value;
+}
+
+static void write32(unsigned char *p, uint32_t value) {
+  write16(p, value >> 16);
+  write16(&p[2], value);
+}
+
+// Writes an E1.31 data packet with count slots to packet, as a source does,
+// and returns its length.
+static size_t build_e131(unsigned char *packet, uint8_t sequence, unsigned char options, size_t count) {
+  memset(packet, 0, DMX_MAX_PACKET_SIZE + 1);
+  write16(&packet[0], 0x0010);
+  memcpy(&packet[4], "ASC-E1.17\0\0", 12);
+  write32(&packet[18], 0x00000004);
+  write32(&packet[40], 0x00000002);
+  memcpy(&packet[44], "check_dmx", 9);
+  packet[108] = 100;
+  packet[111] = sequence;
+  packet[112] = options;
+  write16(&packet[113], UNIVERSE);
+  packet[117] = 0x02;
+  packet[118] = 0xA1;
+  write16(&packet[121], 1);
+  write16(&packet[123], count + 1);
+  for (size_t i = 0; i < count; ++i)
+    packet[126 + i] = i + 1;
+  return 126 + count;
+}
+
+// Writes an ArtDmx packet with count slots to packet and returns its length.
+static size_t build_artnet(unsigned char *packet, uint8_t sequence, unsigned char net, unsigned char subuni, size_t count) {
+  memset(packet, 0, DMX_MAX_PACKET_SIZE + 1);
+  memcpy(packet, "Art-Net", 8);
+  packet[8] = 0x00;
+  packet[9] = 0x50;
+  packet[11] = 14;
+  packet[12] = sequence;
+  packet[14] = subuni;
+  packet[15] = net;
+  write16(&packet[16], count);
+  for (size_t i = 0; i < count; ++i)
+    packet[18 + i] = i + 1;
+  return 18 + count;
+}
+
+static enum DmxProtocol parse(const unsigned char *packet, size_t length) {
+  struct DmxFrame frame;
+  return dmx_parse(packet, length, &frame);
+}
+
+static void check_e131(void) {
+  static unsigned char packet[DMX_MAX_PACKET_SIZE + 1];
+  struct DmxFrame frame;
+  size_t length = build_e131(packet, 42, 0, DMX_MAX_SLOTS);
+  check(dmx_parse(packet, length, &frame) == DMX_E131 && frame.universe == UNIVERSE
+        && frame.sequence == 42 && !frame.terminated && frame.slot_count == DMX_MAX_SLOTS
+        && frame.slots == &packet[126] && frame.slots[0] == 1, "E1.31 full universe");
+
+  length = build_e131(packet, 0, 0, 2);
+  check(dmx_parse(packet, length, &frame) == DMX_E131 && frame.slot_count == 2, "E1.31 short universe");
+  check(parse(packet, length - 1) == DMX_NONE, "E1.31 truncated universe");
+  check(parse(packet, 125) == DMX_NONE, "E1.31 truncated header");
+  write16(&packet[123], 0);
+  check(parse(packet, length) == DMX_NONE, "E1.31 without a start code");
+
+  length = build_e131(packet, 0, 0, DMX_MAX_SLOTS);
+  write16(&packet[123], DMX_MAX_SLOTS + 2);
+  check(parse(packet, length + 1) == DMX_NONE, "E1.31 oversized universe");
+
+  // Each header field in turn.
+  static const struct {
+    size_t offset;
+    unsigned char value;
+    const char *what;
+  } fields[] = {
+    {4, 'X', "E1.31 ACN packet identifier"},
+    {21, 0x08, "E1.31 root vector"},
+    {43, 0x01, "E1.31 framing vector"},
+    {117, 0x01, "E1.31 DMP vector"},
+    {118, 0xA2, "E1.31 address type"},
+    {125, 0xDD, "E1.31 start code"},
+    {112, 0x80, "E1.31 preview data"},
+  };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+    length = build_e131(packet, 0, 0, 4);
+    packet[fields[i].offset] = fields[i].value;
+    check(parse(packet, length) == DMX_NONE, fields[i].what);
+  }
+
+  length = build_e131(packet, 7, 0x40, 4);
+  check(dmx_parse(packet, length, &frame) == DMX_E131 && frame.terminated, "E1.31 stream terminated");
+}
+
+static void check_artnet(void) {
+  static unsigned char packet[DMX_MAX_PACKET_SIZE + 1];
+  struct DmxFrame frame;
+  size_t length = build_artnet(packet, 9, 0x85, 0x34, DMX_MAX_SLOTS);
+  check(dmx_parse(packet, length, &frame) == DMX_ARTNET && frame.universe == 0x0534 && frame.sequence == 9
+        && !frame.terminated && frame.slot_count == DMX_MAX_SLOTS && frame.slots == &packet[18],
+        "Art-Net full universe");
+
+  length = build_artnet(packet, 0, 0, 0, 2);
+  check(dmx_parse(packet, length, &frame) == DMX_ARTNET && frame.slot_count == 2, "Art-Net short universe");
+  check(parse(packet, length - 1) == DMX_NONE, "Art-Net truncated universe");
+  check(parse(packet, 17) == DMX_NONE, "Art-Net truncated header");
+
+  length = build_artnet(packet, 0, 0, 0, DMX_MAX_SLOTS);
+  write16(&packet[16], DMX_MAX_SLOTS + 1);
+  check(parse(packet, length + 1) == DMX_NONE, "Art-Net oversized universe");
+
+  length = build_artnet(packet, 0, 0, 0, 4);
+  packet[6] = 'T';
+  check(parse(packet, length) == DMX_NONE, "Art-Net identifier");
+  length = build_artnet(packet, 0, 0, 0, 4);
+  packet[7] = '!';
+  check(parse(packet, length) == DMX_NONE, "Art-Net identifier terminator");
+  length = build_artnet(packet, 0, 0, 0, 4);
+  packet[9] = 0x20;
+  check(parse(packet, length) == DMX_NONE, "Art-Net OpPoll");
+  length = build_artnet(packet, 0, 0, 0, 4);
+  packet[8] = 0x50;
+  packet[9] = 0x00;
+  check(parse(packet, length) == DMX_NONE, "Art-Net opcode byte order");
+
+  // A packet of the other protocol is not taken for one.
+  length = build_e131(packet, 0, 0, 4);
+  check(dmx_parse(packet, length, &frame) == DMX_E131 && frame.protocol == DMX_E131, "E1.31 is not Art-Net");
+  check(parse((const unsigned char *)"", 0) == DMX_NONE, "empty packet");
+}
+
+static bool accept(struct DmxSequence *sequence, enum DmxProtocol protocol, uint8_t number, bool terminated) {
+  struct DmxFrame frame = {.protocol = protocol, .sequence = number, .terminated = terminated};
+  return dmx_sequence_accept(sequence, &frame);
+}
+
+static void check_sequence(void) {
+  struct DmxSequence sequence = {0};
+  check(accept(&sequence, DMX_E131, 100, false), "first frame");
+  check(!accept(&sequence, DMX_E131, 100, false), "duplicate frame");
+  check(accept(&sequence, DMX_E131, 101, false), "next frame");
+  check(accept(&sequence, DMX_E131, 120, false), "frames skipped");
+
+  // Behind by 1 to 19 is late; by 20 or more the source has restarted.
+  bool late = true;
+  for (int behind = 1; behind < DMX_SEQUENCE_WINDOW; ++behind)
+    late &= !accept(&sequence, DMX_E131, 120 - behind, false);
+  check(late, "late frames in the window");
+  check(accept(&sequence, DMX_E131, 120 - DMX_SEQUENCE_WINDOW, false), "restart at the window edge");
+
+  // The same across the wrap of the counter.
+  sequence = (struct DmxSequence){0};
+  check(accept(&sequence, DMX_E131, 250, false) && accept(&sequence, DMX_E131, 255, false)
+        && accept(&sequence, DMX_E131, 0, false) && accept(&sequence, DMX_E131, 5, false), "wrap forward");
+  check(!accept(&sequence, DMX_E131, 255, false) && !accept(&sequence, DMX_E131, 242, false),
+        "late frames across the wrap");
+  check(accept(&sequence, DMX_E131, 241, false), "restart across the wrap");
+  check(accept(&sequence, DMX_E131, 113, false), "half the counter away");
+
+  // A terminated stream is not applied and anything may start it over.
+  check(!accept(&sequence, DMX_E131, 114, true), "terminated stream");
+  check(accept(&sequence, DMX_E131, 110, false), "stream restarted after termination");
+
+  // Art-Net sources that do not sequence send 0, which is always applied.
+  sequence = (struct DmxSequence){0};
+  check(accept(&sequence, DMX_ARTNET, 0, false) && accept(&sequence, DMX_ARTNET, 0, false), "unsequenced Art-Net");
+  check(accept(&sequence, DMX_ARTNET, 30, false) && !accept(&sequence, DMX_ARTNET, 29, false)
+        && accept(&sequence, DMX_ARTNET, 0, false), "sequenced Art-Net");
+}
+
+int main(void) {
+  check_e131();
+  check_artnet();
+  check_sequence();
+  printf("%u of %u checks passed.\n", checks - failures, checks);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+
+#include "journal.h"
+
+// Runs the state journal against the RAM flash stand-in. Every save is first
+// run whole, then again from the same flash once for each erase and program it
+// does, with the power cut at that step: before any byte, at a random byte of
+// the page, at a random byte of the sector, and after the last byte. After each
+// cut journal_load must return the last complete record: the one before the
+// save, or the new one if its page was programmed far enough to hold it, but
+// never the new one if the cut was in the erase. The recovered journal must
+// then take more saves than a sector holds, each one loading back.
+//
+// Exits with status 1 if a check fails.
+
+#define SEEDS 4
+#define SAVES 400
+#define RECORD_SIZE 48
+#define PROBE_SAVES (2 * FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+struct Record {
+  uint32_t number;
+  uint8_t bytes[RECORD_SIZE - sizeof(uint32_t)];
+};
+
+static uint8_t snapshot[PICO_FLASH_SIZE_BYTES];
+static unsigned failures, cuts;
+static uint32_t rng;
+
+static uint32_t next_random(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void fail(int seed, unsigned save, const char *what) {
+  if (++failures <= 10)
+    printf("FAIL: seed %d, save %u: %s\n", seed, save, what);
+}
+
+static void random_record(struct Record *record, uint32_t number) {
+  record->number = number;
+  for (size_t i = 0; i < sizeof(record->bytes); ++i)
+    record->bytes[i] = next_random();
+}
+
+// Returns whether the journal loads the given record, or none if it is NULL.
+static bool loads(struct Journal *journal, const struct Record *expected) {
+  struct Record record;
+  bool loaded = journal_load(journal, &record, sizeof(record));
+  return expected ? loaded && !memcmp(&record, expected, sizeof(record)) : !loaded;
+}
+
+// Cuts the power at the given step of saving next over the flash before it
+// and checks what the journal recovers.
+static void check_cut(int seed, unsigned n, const struct Journal *before, const struct Record *previous,
+                      const struct Record *next, unsigned step, bool erases, size_t cut_bytes) {
+  memcpy(flash_stub_memory, snapshot, sizeof(snapshot));
+  struct Journal journal = *before;
+  flash_stub.operations = 0;
+  flash_stub.cut_at = step;
+  flash_stub.cut_bytes = cut_bytes;
+  if (!setjmp(flash_stub.power_loss)) {
+    journal_save(&journal, next, sizeof(*next));
+    fail(seed, n, "power cut missed");
+    return;
+  }
+  ++cuts;
+
+  // The new record may only have made it if its page was being programmed.
+  bool in_erase = erases && step == 1;
+  if (!loads(&journal, previous) && (in_erase || !loads(&journal, next))) {
+    fail(seed, n, "wrong record after a power cut");
+    return;
+  }
+  for (uint32_t i = 0; i < PROBE_SAVES; ++i) {
+    struct Record probe;
+    random_record(&probe, 1000000 + i);
+    journal_save(&journal, &probe, sizeof(probe));
+    struct Journal loaded;
+    if (!loads(&loaded, &probe)) {
+      fail(seed, n, "save lost after a power cut");
+      return;
+    }
+  }
+}
+
+static void run_seed(int seed) {
+  struct Journal journal;
+  struct Record previous, next;
+  memset(flash_stub_memory, 0xFF, sizeof(flash_stub_memory));
+  memset(&flash_stub, 0, sizeof(flash_stub));
+  rng = 0x9E3779B9u * (seed + 1);
+  if (!loads(&journal, NULL))
+    fail(seed, 0, "record in erased flash");
+
+  for (unsigned n = 0; n < SAVES; ++n) {
+    random_record(&next, n);
+    memcpy(snapshot, flash_stub_memory, sizeof(snapshot));
+    struct Journal before = journal;
+    struct FlashStub counts = flash_stub;
+    flash_stub.operations = 0;
+    journal_save(&journal, &next, sizeof(next));
+    unsigned steps = flash_stub.operations;
+    static uint8_t after[PICO_FLASH_SIZE_BYTES];
+    memcpy(after, flash_stub_memory, sizeof(after));
+    memcpy(counts.erases, flash_stub.erases, sizeof(counts.erases));
+
+    for (unsigned step = 1; step <= steps; ++step) {
+      const struct Record *expected = n ? &previous : NULL;
+      bool erases = steps == 2;
+      check_cut(seed, n, &before, expected, &next, step, erases, 0);
+      check_cut(seed, n, &before, expected, &next, step, erases, next_random() % FLASH_PAGE_SIZE);
+      check_cut(seed, n, &before, expected, &next, step, erases, next_random() % FLASH_SECTOR_SIZE);
+      check_cut(seed, n, &before, expected, &next, step, erases, FLASH_SECTOR_SIZE);
+    }
+
+    memcpy(flash_stub_memory, after, sizeof(after));
+    memcpy(flash_stub.erases, counts.erases, sizeof(counts.erases));
+    previous = next;
+    struct Journal loaded;
+    if (!loads(&loaded, &next))
+      fail(seed, n, "wrong record");
+    else if (loaded.sequence != journal.sequence || loaded.next_offset != journal.next_offset)
+      fail(seed, n, "load disagrees with save");
+  }
+}
+
+int main(void) {
+  for (int seed = 0; seed < SEEDS; ++seed)
+    run_seed(seed);
+  printf("%u power cuts checked, %u failures.\n", cuts, failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+
+#include "kv.h"
+
+// Runs the settings store against the RAM flash stand-in and checks it
+// against a model of what it should hold. Every operation is first run
+// whole, then again from the same flash once for each erase and program it
+// does, with the power cut at that step: before any byte, at a random byte of
+// the first page, at a random byte of the sector, and after the last byte.
+// After each cut the store is reinitialised from flash: the key being written
+// must hold its old or its new value and every other key its old one. The
+// recovered store must then accept a write and keep all of this. Finally the
+// erases must be spread evenly over the sectors.
+//
+// Built for several KV_SECTORS. Exits with status 1 if a check fails.
+
+#define SEEDS 4
+#define OPERATIONS 1500
+#define KEYS 12
+#define MAX_VALUE 160
+#define PROBE_KEY "probe"
+
+enum OperationType {
+  OP_SET,
+  OP_DELETE,
+  OP_MAINTAIN,
+};
+
+struct Operation {
+  enum OperationType type;
+  unsigned key;
+  uint8_t value[MAX_VALUE];
+  size_t length;
+};
+
+struct Model {
+  bool present[KEYS];
+  uint8_t value[KEYS][MAX_VALUE];
+  size_t length[KEYS];
+};
+
+static uint8_t snapshot[PICO_FLASH_SIZE_BYTES];
+static unsigned failures, cuts;
+static uint32_t rng;
+
+static uint32_t next_random(void) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+static void key_name(unsigned key, char name[8]) {
+  snprintf(name, 8, "key%u", key);
+}
+
+static bool holds(const struct KvStore *store, unsigned key, const struct Model *model) {
+  char name[8];
+  uint8_t value[KV_MAX_VALUE_SIZE];
+  size_t length;
+  key_name(key, name);
+  int status = kv_get(store, name, value, sizeof(value), &length);
+  if (!model->present[key])
+    return status == KV_NOT_FOUND;
+  return status == KV_OK && length == model->length[key] && !memcmp(value, model->value[key], length);
+}
+
+static void fail(int seed, unsigned operation, const char *what) {
+  if (++failures <= 10)
+    printf("FAIL: seed %d, operation %u: %s\n", seed, operation, what);
+}
+
+static void random_operation(struct Operation *op, const struct Model *model) {
+  op->key = next_random() % KEYS;
+  unsigned kind = next_random() % 16;
+  if (kind == 0) {
+    op->type = OP_MAINTAIN;
+  } else if (kind < 4 && model->present[op->key]) {
+    op->type = OP_DELETE;
+  } else {
+    op->type = OP_SET;
+    op->length = next_random() % (MAX_VALUE + 1);
+    for (size_t i = 0; i < op->length; ++i)
+      op->value[i] = next_random();
+  }
+}
+
+static int run(struct KvStore *store, const struct Operation *op) {
+  char name[8];
+  key_name(op->key, name);
+  switch (op->type) {
+  case OP_SET:
+    return kv_set(store, name, op->value, op->length);
+  case OP_DELETE:
+    return kv_delete(store, name);
+  default:
+    kv_maintain(store);
+    return KV_OK;
+  }
+}
+
+static void apply(struct Model *model, const struct Operation *op) {
+  if (op->type == OP_SET) {
+    model->present[op->key] = true;
+    memcpy(model->value[op->key], op->value, op->length);
+    model->length[op->key] = op->length;
+  } else if (op->type == OP_DELETE) {
+    model->present[op->key] = false;
+  }
+}
+
+// Cuts the power at the given step of the operation, from the flash before
+// it, and checks what the store recovers.
+static void check_cut(int seed, unsigned n, const struct Operation *op, const struct KvStore *before,
+                      const struct Model *old, const struct Model *new, unsigned step, size_t cut_bytes) {
+  memcpy(flash_stub_memory, snapshot, sizeof(snapshot));
+  struct KvStore store = *before;
+  flash_stub.operations = 0;
+  flash_stub.cut_at = step;
+  flash_stub.cut_bytes = cut_bytes;
+  if (!setjmp(flash_stub.power_loss)) {
+    run(&store, op);
+    fail(seed, n, "power cut missed");
+    return;
+  }
+  ++cuts;
+
+  kv_init(&store);
+  for (unsigned key = 0; key < KEYS; ++key) {
+    bool ok = holds(&store, key, old) || (key == op->key && holds(&store, key, new));
+    if (!ok) {
+      fail(seed, n, "wrong value after a power cut");
+      return;
+    }
+  }
+  // The recovered store takes a write, finishing any compaction first.
+  uint8_t probe[2] = {step, cut_bytes};
+  size_t length;
+  if (kv_set(&store, PROBE_KEY, probe, sizeof(probe)) != KV_OK) {
+    fail(seed, n, "write after a power cut");
+    return;
+  }
+  kv_init(&store);
+  uint8_t value[sizeof(probe)];
+  if (kv_get(&store, PROBE_KEY, value, sizeof(value), &length) != KV_OK || memcmp(value, probe, sizeof(probe))) {
+    fail(seed, n, "probe lost after a power cut");
+    return;
+  }
+  for (unsigned key = 0; key < KEYS; ++key) {
+    if (!holds(&store, key, old) && !(key == op->key && holds(&store, key, new))) {
+      fail(seed, n, "value lost writing after a power cut");
+      return;
+    }
+  }
+}
+
+static void run_seed(int seed) {
+  static struct Model model;
+  struct KvStore store;
+  memset(&model, 0, sizeof(model));
+  memset(flash_stub_memory, 0xFF, sizeof(flash_stub_memory));
+  memset(&flash_stub, 0, sizeof(flash_stub));
+  rng = 0x9E3779B9u * (seed + 1);
+  kv_init(&store);
+
+  for (unsigned n = 0; n < OPERATIONS; ++n) {
+    static struct Operation op;
+    static struct Model new;
+    random_operation(&op, &model);
+    new = model;
+    apply(&new, &op);
+
+    memcpy(snapshot, flash_stub_memory, sizeof(snapshot));
+    struct KvStore before = store;
+    struct FlashStub counts = flash_stub;
+    flash_stub.operations = 0;
+    if (run(&store, &op) != KV_OK)
+      fail(seed, n, "operation failed");
+    unsigned steps = flash_stub.operations;
+    static uint8_t after[PICO_FLASH_SIZE_BYTES];
+    memcpy(after, flash_stub_memory, sizeof(after));
+    memcpy(counts.erases, flash_stub.erases, sizeof(counts.erases));
+
+    for (unsigned step = 1; step <= steps; ++step) {
+      check_cut(seed, n, &op, &before, &model, &new, step, 0);
+      check_cut(seed, n, &op, &before, &model, &new, step, next_random() % FLASH_PAGE_SIZE);
+      check_cut(seed, n, &op, &before, &model, &new, step, next_random() % FLASH_SECTOR_SIZE);
+      check_cut(seed, n, &op, &before, &model, &new, step, FLASH_SECTOR_SIZE);
+    }
+
+    memcpy(flash_stub_memory, after, sizeof(after));
+    memcpy(flash_stub.erases, counts.erases, sizeof(counts.erases));
+    model = new;
+    for (unsigned key = 0; key < KEYS; ++key) {
+      if (!holds(&store, key, &model))
+        fail(seed, n, "wrong value");
+    }
+    // Replaying the log gives the same store.
+    struct KvStore replayed;
+    kv_init(&replayed);
+    for (unsigned key = 0; key < KEYS; ++key) {
+      if (!holds(&replayed, key, &model))
+        fail(seed, n, "wrong value after replay");
+    }
+  }
+
+  uint32_t min = UINT32_MAX, max = 0;
+  for (unsigned sector = 0; sector < KV_SECTORS; ++sector) {
+    uint32_t erases = flash_stub.erases[KV_OFFSET / FLASH_SECTOR_SIZE + sector];
+    min = erases < min ? erases : min;
+    max = erases > max ? erases : max;
+  }
+  printf("seed %d: %u sectors erased %lu to %lu times\n", seed, KV_SECTORS, (unsigned long)min, (unsigned long)max);
+  if (max > min + 1)
+    fail(seed, OPERATIONS, "uneven wear");
+}
+
+int main(void) {
+  for (int seed = 0; seed < SEEDS; ++seed)
+    run_seed(seed);
+  printf("%u power cuts checked, %u failures.\n", cuts, failures);
+  return failures ? 1 : 0;
+}
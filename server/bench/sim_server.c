@@ -0,0 +1,456 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "lighting_stub.h"
+#include "lwip/tcp.h"
+#include "pico/time.h"
+
+#include "command.h"
+#include "connection.h"
+#include "server.h"
+#include "ws.h"
+
+// Runs the server core (server.c and the modules below it) on the host, with
+// the TCP stand-in in place of lwIP, the lighting stand-in in place of the LED
+// GPIOs and a virtual clock. Clients are played by the tcp_stub_* functions,
+// so every run is deterministic. It first checks scripted sessions against the
+// expected responses, then times the full request path per request, from the
+// segment reaching the receive callback to the response being queued.
+//
+// Exits with status 1 if a check fails.
+
+#define EPOCH 0x5EED0001
+#define ITERATIONS 100000
+#define OUTPUT_SIZE 8192
+// The timeouts of server.c.
+#define HTTP_REQUEST_TIMEOUT_MS 5000
+#define IDLE_PING_MS 20000
+#define PONG_TIMEOUT_MS 5000
+#define STREAM_PUBLISH_MS 250
+
+#define HANDSHAKE(target) \
+  "GET " target " HTTP/1.1\r\n" \
+  "Host: 192.168.1.23\r\n" \
+  "Connection: Upgrade\r\n" \
+  "Upgrade: websocket\r\n" \
+  "Sec-WebSocket-Version: 13\r\n" \
+  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n" \
+  "\r\n"
+#define ACCEPT_KEY "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+uint64_t time_stub_now_us;
+
+static struct tcp_pcb pcbs[MAX_CONNECTIONS + 1];
+static unsigned char output[OUTPUT_SIZE + 1];
+static size_t output_length;
+static unsigned checks, failures;
+
+// The host has no radio, DMX input or lwIP pools to report.
+void server_add_platform_metrics(struct Metrics *metrics) {
+}
+
+static void check(bool ok, const char *what) {
+  ++checks;
+  if (!ok) {
+    ++failures;
+    printf("FAIL: %s\n", what);
+  }
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void advance_ms(uint32_t ms) {
+  time_stub_now_us += ms * 1000ull;
+}
+
+// Opens a connection on pcb, as lwIP does for a new client. Returns whether
+// the server took it.
+static bool client_connect(struct tcp_pcb *pcb) {
+  memset(pcb, 0, sizeof(*pcb));
+  return server_accept(NULL, pcb, ERR_OK) == ERR_OK;
+}
+
+static void client_send(struct tcp_pcb *pcb, const void *data, size_t length) {
+  // The server unmasks frames in place, so it gets a copy.
+  static unsigned char segment[OUTPUT_SIZE];
+  memcpy(segment, data, length);
+  tcp_stub_receive(pcb, segment, length);
+}
+
+static void client_send_text(struct tcp_pcb *pcb, const char *text) {
+  client_send(pcb, text, strlen(text));
+}
+
+// Sends a masked frame of a short payload, as a client must.
+static void client_send_frame(struct tcp_pcb *pcb, unsigned char opcode, const unsigned char *payload, size_t length) {
+  static const unsigned char mask[4] = {0x12, 0x34, 0x56, 0x78};
+  unsigned char frame[2 + 4 + WS_MAX_CONTROL_PAYLOAD] = {WS_FIN | opcode, WS_MASK | length};
+  memcpy(&frame[2], mask, 4);
+  for (size_t i = 0; i < length; ++i)
+    frame[6 + i] = payload[i] ^ mask[i & 3];
+  client_send(pcb, frame, 6 + length);
+}
+
+// Takes everything the server has queued on pcb into output, acknowledging it.
+static void client_read(struct tcp_pcb *pcb) {
+  output_length = tcp_stub_unacked(pcb, output, OUTPUT_SIZE);
+  output[output_length] = '\0';
+  tcp_stub_ack(pcb);
+}
+
+static bool output_contains(const char *text) {
+  return strstr((const char *)output, text) != NULL;
+}
+
+// Returns the payload of the n-th WebSocket frame in output, or NULL.
+static const unsigned char *output_frame(size_t n, size_t *length) {
+  const unsigned char *p = output, *end = output + output_length;
+  const char *headers_end = strstr((const char *)output, "\r\n\r\n");
+  if (headers_end)
+    p = (const unsigned char *)headers_end + 4;
+  for (; p + 2 <= end; p += 2 + p[1]) {
+    if (p + 2 + p[1] > end)
+      return NULL;
+    if (n-- == 0) {
+      *length = p[1];
+      return &p[2];
+    }
+  }
+  return NULL;
+}
+
+static bool frame_is(size_t n, unsigned char type) {
+  size_t length;
+  const unsigned char *payload = output_frame(n, &length);
+  return payload && length >= 2 && payload[0] == CMD_VERSION && payload[1] == type;
+}
+
+// Returns the state version of the n-th frame in output, or 0 if it is not a
+// state.
+static uint32_t frame_version(size_t n) {
+  size_t length;
+  const unsigned char *payload = output_frame(n, &length);
+  if (!frame_is(n, CMD_STATE) || length != CMD_STATE_SIZE)
+    return 0;
+  return (uint32_t)payload[10] << 24 | (uint32_t)payload[11] << 16 | (uint32_t)payload[12] << 8 | payload[13];
+}
+
+static void reset(void) {
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+    if (connections[i].state != FREE)
+      connection_abort(&connections[i]);
+  }
+}
+
+static void check_rest(void) {
+  struct tcp_pcb *pcb = &pcbs[0];
+  check(client_connect(pcb), "accept");
+
+  client_send_text(pcb, "GET /health HTTP/1.1\r\n\r\n");
+  client_read(pcb);
+  check(!strncmp((const char *)output, "HTTP/1.1 200 OK", 15) && output_contains("\"clients\":0"), "GET /health");
+
+  client_send_text(pcb, "PUT /state HTTP/1.1\r\nContent-Length: 24\r\n\r\n{\"on\":true,\"level\":1000}");
+  client_read(pcb);
+  check(output_contains("200 OK") && output_contains("\"level\":1000"), "PUT /state");
+  check(lighting_stub.level == 1000, "PUT /state sets the LED");
+
+  client_send_text(pcb, "PUT /state HTTP/1.1\r\nContent-Length: 6\r\n\r\n{\"on\":");
+  client_read(pcb);
+  check(output_contains("400 Bad Request") && lighting_stub.level == 1000, "PUT /state with an invalid body");
+
+  // Without "on" or "level" the LED stays as the button left it.
+  server_toggle_led();
+  server_send_state();
+  client_send_text(pcb, "PUT /state HTTP/1.1\r\nContent-Length: 21\r\n\r\n{\"transition_ms\":100}");
+  client_read(pcb);
+  check(output_contains("\"on\":false") && lighting_stub.level == 0, "PUT /state after a button press");
+  server_toggle_led();
+  server_send_state();
+
+  // Pipelined requests are answered in order in one burst.
+  client_send_text(pcb, "GET /missing HTTP/1.1\r\n\r\nDELETE /state HTTP/1.1\r\n\r\nGET /metrics HTTP/1.1\r\n\r\n");
+  client_read(pcb);
+  char *not_found = strstr((char *)output, "404 Not Found");
+  char *not_allowed = strstr((char *)output, "405 Method Not Allowed");
+  check(not_found && not_allowed && not_found < not_allowed, "pipelined requests");
+  check(output_contains("smart_led_connections_accepted_total 1"), "GET /metrics");
+  check(!pcb->closed, "keep-alive");
+
+  client_send_text(pcb, "GET /state HTTP/1.1\r\nConnection: close\r\n\r\n");
+  client_read(pcb);
+  check(output_contains("Connection: close") && pcb->closed, "Connection: close");
+}
+
+static void check_websocket(void) {
+  struct tcp_pcb *a = &pcbs[0], *b = &pcbs[1], *c = &pcbs[2];
+  client_connect(a);
+  client_send_text(a, HANDSHAKE("/"));
+  client_read(a);
+  check(output_contains("101 Switching Protocols") && output_contains("Sec-WebSocket-Accept: " ACCEPT_KEY), "handshake");
+  check(frame_is(0, CMD_SYNC) && frame_is(1, CMD_STATE), "sync after the handshake");
+  uint32_t version = server_state_log()->version;
+
+  client_connect(b);
+  client_send_text(b, HANDSHAKE("/"));
+  client_read(b);
+
+  // A toggle is acknowledged to its sender and published to every client.
+  static const unsigned char toggle[] = {CMD_VERSION, 0, 1, 1, CMD_TOGGLE, 0};
+  client_send_frame(a, WS_OP_BINARY, toggle, sizeof(toggle));
+  client_read(a);
+  size_t length;
+  const unsigned char *ack = output_frame(0, &length);
+  check(ack && length == CMD_ACK_HEADER_SIZE && ack[1] == CMD_ACK && ack[3] == 1 && ack[4] == CMD_STATUS_OK, "acknowledgement");
+  check(frame_is(1, CMD_STATE), "state to the sender");
+  client_read(b);
+  check(frame_is(0, CMD_STATE), "state to the other client");
+  check(lighting_stub.level == 0 && server_state_log()->version == version + 1, "toggle");
+
+  // A rejected batch changes nothing and is not published.
+  static const unsigned char bad_channel[] = {CMD_VERSION, 0, 2, 1, CMD_TOGGLE, 1};
+  client_send_frame(a, WS_OP_BINARY, bad_channel, sizeof(bad_channel));
+  client_read(a);
+  ack = output_frame(0, &length);
+  check(ack && ack[4] == CMD_STATUS_BAD_CHANNEL && !output_frame(1, &length), "rejected batch");
+  client_read(b);
+  check(output_length == 0 && server_state_log()->version == version + 1, "rejected batch not published");
+
+  client_send_frame(a, WS_OP_PING, (const unsigned char *)"hi", 2);
+  client_read(a);
+  check(output_length == 4 && output[0] == (WS_FIN | WS_OP_PONG) && !memcmp(&output[2], "hi", 2), "ping");
+
+  // The button as the interrupt and the main loop handle it.
+  server_toggle_led();
+  server_send_state();
+  client_read(a);
+  check(frame_is(0, CMD_STATE), "button press published");
+  client_read(b);
+  check(frame_is(0, CMD_STATE) && lighting_stub.level == 1000, "button press");
+
+  // A client that saw the state before the button press is sent only it.
+  char target[64];
+  char handshake[256];
+  snprintf(target, sizeof(target), "/?epoch=%u&version=%u", EPOCH, (unsigned)version + 1);
+  snprintf(handshake, sizeof(handshake), HANDSHAKE("%s"), target);
+  client_connect(c);
+  client_send_text(c, handshake);
+  client_read(c);
+  const unsigned char *sync = output_frame(0, &length);
+  check(sync && sync[1] == CMD_SYNC && sync[10] == 1 && sync[11] == 0, "delta sync");
+
+  // States published before a client reads them each keep their own version.
+  server_toggle_led();
+  server_send_state();
+  server_toggle_led();
+  server_send_state();
+  client_read(b);
+  uint32_t latest = server_state_log()->version;
+  check(frame_version(0) == latest - 1 && frame_version(1) == latest, "queued states");
+  client_read(a);
+  client_read(c);
+
+  // The close frame is echoed before the connection is closed.
+  static const unsigned char status[] = {WS_CLOSE_NORMAL >> 8, WS_CLOSE_NORMAL & 0xFF};
+  client_send_frame(a, WS_OP_CLOSE, status, sizeof(status));
+  client_read(a);
+  check(a->closed && output_length == 4 && output[0] == (WS_FIN | WS_OP_CLOSE), "close");
+  reset();
+}
+
+static void check_timeouts(void) {
+  struct tcp_pcb *http = &pcbs[0], *ws = &pcbs[1];
+  client_connect(http);
+  client_send_text(http, "GET /sta");
+  advance_ms(HTTP_REQUEST_TIMEOUT_MS - 1);
+  tcp_stub_poll(http);
+  check(!http->closed, "HTTP request before its timeout");
+  advance_ms(1);
+  tcp_stub_poll(http);
+  check(http->closed, "HTTP request timeout");
+
+  client_connect(ws);
+  client_send_text(ws, HANDSHAKE("/"));
+  client_read(ws);
+  advance_ms(IDLE_PING_MS);
+  tcp_stub_poll(ws);
+  client_read(ws);
+  check(output_length == 2 && output[0] == (WS_FIN | WS_OP_PING), "idle ping");
+  advance_ms(PONG_TIMEOUT_MS);
+  tcp_stub_poll(ws);
+  check(ws->closed, "pong timeout");
+  reset();
+}
+
+// Levels streamed over DMX are published as they change, at a limited rate,
+// and reading the state publishes nothing.
+static void check_stream(void) {
+  struct tcp_pcb *ws = &pcbs[0], *http = &pcbs[1], *late = &pcbs[2];
+  client_connect(ws);
+  client_send_text(ws, HANDSHAKE("/"));
+  client_read(ws);
+  advance_ms(STREAM_PUBLISH_MS);
+  uint32_t version = server_state_log()->version;
+
+  server_stream_level(500);
+  client_read(ws);
+  check(frame_version(0) == version + 1 && lighting_stub.level == 500, "streamed level published");
+  server_stream_level(600);
+  client_read(ws);
+  check(output_length == 0 && lighting_stub.level == 600, "streamed level rate limited");
+
+  char expected[32];
+  snprintf(expected, sizeof(expected), "\"version\":%u}", (unsigned)version + 1);
+  client_connect(http);
+  client_send_text(http, "GET /state HTTP/1.1\r\n\r\n");
+  client_read(http);
+  check(output_contains("\"level\":500") && output_contains(expected), "GET /state reports the published state");
+  client_connect(late);
+  client_send_text(late, HANDSHAKE("/"));
+  client_read(late);
+  check(frame_version(1) == version + 1, "handshake syncs the published state");
+  client_read(ws);
+  check(output_length == 0 && server_state_log()->version == version + 1, "reads publish nothing");
+
+  // A repeated frame publishes the level held back.
+  advance_ms(STREAM_PUBLISH_MS);
+  server_stream_level(600);
+  server_stream_level(600);
+  client_read(ws);
+  check(frame_version(0) == version + 2 && !output_frame(1, &(size_t){0}), "held level published once");
+  reset();
+}
+
+// A client whose send buffer is full misses states, and is sent the current
+// one as soon as it acknowledges data.
+static void check_full_send_buffer(void) {
+  struct tcp_pcb *ws = &pcbs[0];
+  client_connect(ws);
+  client_send_text(ws, HANDSHAKE("/"));
+  client_read(ws);
+  for (size_t i = 0; i <= TCP_STUB_SND_QUEUELEN; ++i) {
+    server_toggle_led();
+    server_send_state();
+  }
+  uint32_t latest = server_state_log()->version;
+  client_read(ws);
+  check(frame_version(TCP_STUB_SND_QUEUELEN - 1) == latest - 1, "states queued until the buffer is full");
+  client_read(ws);
+  check(frame_version(0) == latest && !output_frame(1, &(size_t){0}), "missed state sent after the ack");
+
+  // Room can also come free without a sent callback, when the write failed
+  // for pbuf memory, so the poll timer tries too.
+  for (size_t i = 0; i <= TCP_STUB_SND_QUEUELEN; ++i) {
+    server_toggle_led();
+    server_send_state();
+  }
+  latest = server_state_log()->version;
+  ws->snd_queuelen = 0;
+  ws->snd_buf_length = 0;
+  tcp_stub_poll(ws);
+  client_read(ws);
+  check(frame_version(0) == latest, "missed state sent from the poll timer");
+  reset();
+
+  // A handshake whose response does not fit aborts the connection. Each
+  // response to GET /state takes two writes, so 31 of them leave room for
+  // part of the headers and 30 for the headers and the sync but not the state.
+  static const char *const parts[] = {"headers", "sync"};
+  for (size_t i = 0; i < 2; ++i) {
+    static char pipeline[OUTPUT_SIZE];
+    size_t length = 0;
+    for (size_t n = 0; n < TCP_STUB_SND_QUEUELEN / 2 - 1 - i; ++n)
+      length += sprintf(&pipeline[length], "GET /state HTTP/1.1\r\n\r\n");
+    strcpy(&pipeline[length], HANDSHAKE("/"));
+    client_connect(ws);
+    client_send_text(ws, pipeline);
+    char what[64];
+    snprintf(what, sizeof(what), "handshake aborted without room for the %s", parts[i]);
+    check(ws->closed && !ws->arg, what);
+    reset();
+  }
+}
+
+static void check_connection_limit(void) {
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i)
+    client_connect(&pcbs[i]);
+  check(!client_connect(&pcbs[MAX_CONNECTIONS]) && pcbs[MAX_CONNECTIONS].closed, "connection table full");
+  reset();
+}
+
+// Sends a TOGGLE batch from one client with others listening, as the state
+// update goes to all of them.
+static double bench_batch(size_t clients) {
+  for (size_t i = 0; i < clients; ++i) {
+    client_connect(&pcbs[i]);
+    client_send_text(&pcbs[i], HANDSHAKE("/"));
+    tcp_stub_ack(&pcbs[i]);
+  }
+  unsigned char toggle[] = {CMD_VERSION, 0, 0, 1, CMD_TOGGLE, 0};
+  double start = now_ns();
+  for (size_t n = 0; n < ITERATIONS; ++n) {
+    toggle[2] = n;
+    client_send_frame(&pcbs[0], WS_OP_BINARY, toggle, sizeof(toggle));
+    for (size_t i = 0; i < clients; ++i)
+      tcp_stub_ack(&pcbs[i]);
+  }
+  double ns = (now_ns() - start) / ITERATIONS;
+  reset();
+  return ns;
+}
+
+static double bench_rest(const char *request) {
+  client_connect(&pcbs[0]);
+  double start = now_ns();
+  for (size_t n = 0; n < ITERATIONS; ++n) {
+    client_send_text(&pcbs[0], request);
+    tcp_stub_ack(&pcbs[0]);
+  }
+  double ns = (now_ns() - start) / ITERATIONS;
+  reset();
+  return ns;
+}
+
+static double bench_handshake(void) {
+  double start = now_ns();
+  for (size_t n = 0; n < ITERATIONS; ++n) {
+    client_connect(&pcbs[0]);
+    client_send_text(&pcbs[0], HANDSHAKE("/"));
+    tcp_stub_ack(&pcbs[0]);
+    tcp_stub_receive(&pcbs[0], NULL, 0);
+  }
+  return (now_ns() - start) / ITERATIONS;
+}
+
+int main(void) {
+  time_stub_now_us = 1000000;
+  struct CommandState state = {.on = false, .level = LED_MAX_LEVEL};
+  server_restore_state(&state);
+  server_init(EPOCH);
+
+  check_rest();
+  check_websocket();
+  check_timeouts();
+  check_stream();
+  check_full_send_buffer();
+  check_connection_limit();
+  printf("%u of %u checks passed.\n\n", checks - failures, checks);
+
+  printf("%-32s %12s\n", "request", "ns");
+  static const size_t client_counts[] = {1, 4, 8};
+  for (size_t i = 0; i < sizeof(client_counts) / sizeof(client_counts[0]); ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "batch, %zu clients", client_counts[i]);
+    printf("%-32s %12.1f\n", name, bench_batch(client_counts[i]));
+  }
+  printf("%-32s %12.1f\n", "GET /state", bench_rest("GET /state HTTP/1.1\r\n\r\n"));
+  printf("%-32s %12.1f\n", "GET /metrics", bench_rest("GET /metrics HTTP/1.1\r\n\r\n"));
+  printf("%-32s %12.1f\n", "handshake and close", bench_handshake());
+  return failures ? 1 : 0;
+}
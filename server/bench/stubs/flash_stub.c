@@ -0,0 +1,48 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+
+uint8_t flash_stub_memory[PICO_FLASH_SIZE_BYTES];
+struct FlashStub flash_stub;
+
+// Counts an operation and returns whether it is the one cut short.
+static bool cut(void) {
+  return ++flash_stub.operations == flash_stub.cut_at;
+}
+
+static void power_loss(void) {
+  flash_stub.cut_at = 0;
+  longjmp(flash_stub.power_loss, 1);
+}
+
+void flash_range_erase(uint32_t offset, size_t count) {
+  assert(offset % FLASH_SECTOR_SIZE == 0 && count % FLASH_SECTOR_SIZE == 0);
+  assert(offset + count <= PICO_FLASH_SIZE_BYTES);
+  bool cut_here = cut();
+  size_t n = cut_here && flash_stub.cut_bytes < count ? flash_stub.cut_bytes : 0;
+  if (!cut_here || n < count)
+    memset(&flash_stub_memory[offset + n], 0xFF, count - n);
+  for (uint32_t sector = offset / FLASH_SECTOR_SIZE; sector < (offset + count) / FLASH_SECTOR_SIZE; ++sector)
+    ++flash_stub.erases[sector];
+  if (cut_here) {
+    if (n > 0 && n < count)
+      flash_stub_memory[offset + n - 1] |= 0xA5;
+    power_loss();
+  }
+}
+
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count) {
+  assert(offset % FLASH_PAGE_SIZE == 0 && count % FLASH_PAGE_SIZE == 0);
+  assert(offset + count <= PICO_FLASH_SIZE_BYTES);
+  bool cut_here = cut();
+  size_t n = cut_here && flash_stub.cut_bytes < count ? flash_stub.cut_bytes : count;
+  for (size_t i = 0; i < n; ++i)
+    flash_stub_memory[offset + i] &= data[i];
+  if (cut_here) {
+    if (n < count)
+      flash_stub_memory[offset + n] &= data[n] | 0x5A;
+    power_loss();
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Flash in RAM, read through XIP like the real one. Programming can only clear
+// bits and erasing sets a whole sector to 0xFF, as on NOR flash. Any erase or
+// program can be cut short to simulate a power loss: the operation numbered
+// cut_at (counted from 1 in operations) jumps to power_loss with only part of
+// its bytes written. A program writes its first cut_bytes bytes and half of
+// the next one. An erase leaves its first cut_bytes bytes as they were, the
+// last of them half erased, and erases the rest, so a sector header can
+// outlive an erase that did not finish. erases counts the erases of each
+// sector, for wear levelling.
+
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+#define PICO_FLASH_SIZE_BYTES (16 * FLASH_SECTOR_SIZE)
+#define FLASH_STUB_SECTORS (PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE)
+#define XIP_BASE ((uintptr_t)flash_stub_memory)
+
+struct FlashStub {
+  unsigned operations;
+  unsigned cut_at;
+  size_t cut_bytes;
+  jmp_buf power_loss;
+  uint32_t erases[FLASH_STUB_SECTORS];
+};
+
+extern uint8_t flash_stub_memory[PICO_FLASH_SIZE_BYTES];
+extern struct FlashStub flash_stub;
+
+void flash_range_erase(uint32_t offset, size_t count);
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// The host runs the server on one thread without interrupts.
+
+static inline uint32_t save_and_disable_interrupts(void) {
+  return 0;
+}
+
+static inline void restore_interrupts(uint32_t status) {
+}
@@ -0,0 +1,37 @@
+#include <stddef.h>
+
+#include "histogram.h"
+#include "lighting_stub.h"
+
+struct LightingStub lighting_stub;
+// The outputs change as soon as they are set, so this stays empty.
+static struct Histogram output_latency;
+
+void lighting_init(void) {
+}
+
+void lighting_set_level(uint16_t level, uint32_t transition_ms) {
+  lighting_stub.level = level;
+  lighting_stub.transition_ms = transition_ms;
+  ++lighting_stub.level_changes;
+}
+
+void lighting_set_effect(const struct LightingEffect *effect) {
+  lighting_stub.effect = *effect;
+}
+
+void lighting_set_pixels(const uint8_t *data, size_t length) {
+  ++lighting_stub.pixel_frames;
+}
+
+const struct Histogram *lighting_output_latency(void) {
+  return &output_latency;
+}
+
+void lighting_pause(void) {
+  lighting_stub.paused = true;
+}
+
+void lighting_resume(void) {
+  lighting_stub.paused = false;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lighting.h"
+
+// Stand-in for the lighting engine: instead of driving the PWM and strip
+// GPIOs from core 1, it records what they were last set to.
+struct LightingStub {
+  uint16_t level;
+  uint32_t transition_ms;
+  struct LightingEffect effect;
+  uint32_t level_changes;
+  uint32_t pixel_frames;
+  bool paused;
+};
+
+extern struct LightingStub lighting_stub;
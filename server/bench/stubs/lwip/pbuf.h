@@ -0,0 +1,16 @@
+#pragma once
+
+// Minimal stand-in for lwIP packet buffers. The chains handed to the receive
+// callback are built by tcp_stub_receive and owned by it, so freeing them does
+// nothing.
+
+#include <stdint.h>
+
+struct pbuf {
+  struct pbuf *next;
+  void *payload;
+  uint16_t tot_len;
+  uint16_t len;
+};
+
+uint8_t pbuf_free(struct pbuf *p);
@@ -0,0 +1,85 @@
+#pragma once
+
+// Minimal stand-in for the parts of the lwIP raw TCP API used by the server,
+// so that the server core can be benchmarked on the host. Writes are recorded
+// in the pcb instead of being sent anywhere, and the tcp_stub_* functions play
+// the peer and the stack: they deliver data, acknowledge what was sent and
+// fire the poll timer, all synchronously.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/pbuf.h"
+
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t err_t;
+
+#define ERR_OK 0
+#define ERR_MEM -1
+#define ERR_VAL -6
+#define ERR_ABRT -13
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+#define TCP_STUB_SND_BUF 8192
+#define TCP_STUB_SND_QUEUELEN 64
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+typedef err_t (*tcp_poll_fn)(void *arg, struct tcp_pcb *pcb);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *pcb, u16_t len);
+
+struct tcp_pcb {
+  void *arg;
+  tcp_recv_fn recv;
+  tcp_err_fn errf;
+  tcp_poll_fn poll;
+  tcp_sent_fn sent;
+  u8_t pollinterval;
+  // Data written with TCP_WRITE_FLAG_COPY is copied here, data written without
+  // it is only referenced, like lwIP does with PBUF_ROM segments.
+  unsigned char snd_buf[TCP_STUB_SND_BUF];
+  size_t snd_buf_length;
+  const void *snd_refs[TCP_STUB_SND_QUEUELEN];
+  u16_t snd_lens[TCP_STUB_SND_QUEUELEN];
+  size_t snd_queuelen;
+  // Sequence numbers of the last acknowledged byte and the last byte written.
+  u32_t lastack;
+  u32_t snd_lbb;
+  size_t outputs;
+  bool closed;
+};
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg);
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv);
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err);
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval);
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent);
+void tcp_recved(struct tcp_pcb *pcb, u16_t len);
+err_t tcp_write(struct tcp_pcb *pcb, const void *data, u16_t len, u8_t apiflags);
+err_t tcp_output(struct tcp_pcb *pcb);
+err_t tcp_close(struct tcp_pcb *pcb);
+void tcp_abort(struct tcp_pcb *pcb);
+
+// Drops everything recorded as sent, as if the peer had acknowledged it, and
+// calls the sent callback.
+void tcp_stub_ack(struct tcp_pcb *pcb);
+
+// Passes length bytes of data to the receive callback in one pbuf, or the end
+// of the stream if data is NULL. The data may be modified. Returns what the
+// callback returned.
+err_t tcp_stub_receive(struct tcp_pcb *pcb, void *data, u16_t length);
+
+// Calls the poll callback, as the coarse TCP timer does every pollinterval
+// ticks.
+err_t tcp_stub_poll(struct tcp_pcb *pcb);
+
+// Copies the data written since the last acknowledgement to buf, which holds
+// size bytes, in order. Returns its length.
+size_t tcp_stub_unacked(const struct tcp_pcb *pcb, void *buf, size_t size);
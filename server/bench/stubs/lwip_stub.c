@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include "lwip/tcp.h"
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) {
+  pcb->arg = arg;
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {
+  pcb->recv = recv;
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) {
+  pcb->errf = err;
+}
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval) {
+  pcb->poll = poll;
+  pcb->pollinterval = interval;
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) {
+  pcb->sent = sent;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len) {
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *data, u16_t len, u8_t apiflags) {
+  if (pcb->snd_queuelen == TCP_STUB_SND_QUEUELEN)
+    return ERR_MEM;
+  if (apiflags & TCP_WRITE_FLAG_COPY) {
+    if (pcb->snd_buf_length + len > TCP_STUB_SND_BUF)
+      return ERR_MEM;
+    memcpy(&pcb->snd_buf[pcb->snd_buf_length], data, len);
+    pcb->snd_refs[pcb->snd_queuelen] = &pcb->snd_buf[pcb->snd_buf_length];
+    pcb->snd_buf_length += len;
+  } else {
+    pcb->snd_refs[pcb->snd_queuelen] = data;
+  }
+  pcb->snd_lens[pcb->snd_queuelen++] = len;
+  pcb->snd_lbb += len;
+  return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+  ++pcb->outputs;
+  return ERR_OK;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+  pcb->closed = true;
+  return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) {
+  pcb->closed = true;
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+  return 0;
+}
+
+void tcp_stub_ack(struct tcp_pcb *pcb) {
+  u16_t length = pcb->snd_lbb - pcb->lastack;
+  pcb->snd_buf_length = 0;
+  pcb->snd_queuelen = 0;
+  pcb->lastack = pcb->snd_lbb;
+  if (pcb->sent && length)
+    pcb->sent(pcb->arg, pcb, length);
+}
+
+err_t tcp_stub_receive(struct tcp_pcb *pcb, void *data, u16_t length) {
+  struct pbuf p = {NULL, data, length, length};
+  if (!pcb->recv)
+    return ERR_OK;
+  return pcb->recv(pcb->arg, pcb, data ? &p : NULL, ERR_OK);
+}
+
+err_t tcp_stub_poll(struct tcp_pcb *pcb) {
+  return pcb->poll ? pcb->poll(pcb->arg, pcb) : ERR_OK;
+}
+
+size_t tcp_stub_unacked(const struct tcp_pcb *pcb, void *buf, size_t size) {
+  size_t length = 0;
+  for (size_t i = 0; i < pcb->snd_queuelen && length + pcb->snd_lens[i] <= size; ++i) {
+    memcpy((unsigned char *)buf + length, pcb->snd_refs[i], pcb->snd_lens[i]);
+    length += pcb->snd_lens[i];
+  }
+  return length;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#if TIME_STUB_VIRTUAL
+// Virtual time, advanced only by the program, so that runs are reproducible
+// and timeouts take no real time.
+extern uint64_t time_stub_now_us;
+
+static inline uint64_t time_us_64(void) {
+  return time_stub_now_us;
+}
+#else
+static inline uint64_t time_us_64(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
@@ -0,0 +1,40 @@
+#include <stdio.h>
+
+#include "pico/time.h"
+
+#include "boot_timeline.h"
+
+static uint64_t times_us[BOOT_PHASE_COUNT];
+
+static const char *const names[BOOT_PHASE_COUNT] = {
+  [BOOT_STDIO] = "stdio",
+  [BOOT_STORAGE] = "storage",
+  [BOOT_RADIO] = "radio",
+  [BOOT_JOINED] = "joined",
+  [BOOT_ADDRESS] = "address",
+  [BOOT_BOUND] = "bound",
+  [BOOT_LISTENING] = "listening",
+  [BOOT_FIRST_CLIENT] = "first client",
+};
+
+void boot_timeline_mark(enum BootPhase phase) {
+  times_us[phase] = time_us_64();
+}
+
+uint64_t boot_timeline_get(enum BootPhase phase) {
+  return times_us[phase];
+}
+
+void boot_timeline_print(void) {
+  printf("Boot timeline:\n");
+  uint64_t previous_us = 0;
+  for (int phase = 0; phase < BOOT_PHASE_COUNT; ++phase) {
+    if (!times_us[phase]) {
+      printf("  %-12s -\n", names[phase]);
+      continue;
+    }
+    printf("  %-12s %8lu us (+%lu us)\n", names[phase], (unsigned long)times_us[phase],
+           (unsigned long)(times_us[phase] - previous_us));
+    previous_us = times_us[phase];
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// Timeline of the boot phases, each stamped with time_us_64 (time since
+// reset) when it completes, so that the time to get online can be tracked
+// across firmware versions. It stays available after boot: it is printed on
+// request over USB stdio and sent to clients that ask for it.
+
+enum BootPhase {
+  BOOT_STDIO,
+  BOOT_STORAGE,
+  BOOT_RADIO,
+  BOOT_JOINED,
+  BOOT_ADDRESS,
+  BOOT_BOUND,
+  BOOT_LISTENING,
+  BOOT_FIRST_CLIENT,
+  BOOT_PHASE_COUNT,
+};
+
+// Records that phase completed now, replacing an earlier time, so that a
+// phase that is retried keeps the time of its last attempt.
+void boot_timeline_mark(enum BootPhase phase);
+
+// Returns when phase completed, or 0 if it has not yet.
+uint64_t boot_timeline_get(enum BootPhase phase);
+
+// Prints every phase with its time since reset and since the previous phase.
+void boot_timeline_print(void);
@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "command.h"
+
+static void encode_u32(unsigned char *buf, uint32_t value) {
+  buf[0] = value >> 24;
+  buf[1] = value >> 16;
+  buf[2] = value >> 8;
+  buf[3] = value;
+}
+
+static size_t command_size(unsigned char opcode) {
+  switch (opcode) {
+  case CMD_SET:
+    return 3;
+  case CMD_TOGGLE:
+  case CMD_QUERY:
+  case CMD_BOOT:
+    return 2;
+  case CMD_FADE:
+    return 6;
+  case CMD_EFFECT:
+    return 7;
+  default:
+    return 0;
+  }
+}
+
+int command_batch_open(struct CommandBatch *batch, const unsigned char *payload, size_t length, size_t channel_count) {
+  memset(batch, 0, sizeof(*batch));
+  if (length < CMD_HEADER_SIZE)
+    return CMD_STATUS_MALFORMED;
+  batch->sequence = (uint16_t)payload[1] << 8 | payload[2];
+  if (payload[0] != CMD_VERSION)
+    return CMD_STATUS_BAD_VERSION;
+
+  const unsigned char *c = &payload[CMD_HEADER_SIZE], *end = &payload[length];
+  size_t queries = 0;
+  for (size_t i = 0; i < payload[3]; ++i) {
+    if (c == end)
+      return CMD_STATUS_MALFORMED;
+    size_t size = command_size(c[0]);
+    if (!size || (size_t)(end - c) < size)
+      return CMD_STATUS_MALFORMED;
+    if (c[1] >= channel_count)
+      return CMD_STATUS_BAD_CHANNEL;
+    if (c[0] == CMD_QUERY && ++queries > CMD_MAX_RESULTS)
+      return CMD_STATUS_TOO_MANY_RESULTS;
+    // Effects other than steady need a period.
+    if (c[0] == CMD_EFFECT && (c[2] >= CMD_MODE_COUNT || (c[2] != CMD_MODE_STEADY && !(c[3] | c[4]))))
+      return CMD_STATUS_BAD_VALUE;
+    c += size;
+  }
+  if (c != end)
+    return CMD_STATUS_MALFORMED;
+
+  batch->count = payload[3];
+  batch->next = &payload[CMD_HEADER_SIZE];
+  batch->end = end;
+  return CMD_STATUS_OK;
+}
+
+bool command_batch_next(struct CommandBatch *batch, struct Command *command) {
+  if (batch->next == batch->end)
+    return false;
+  const unsigned char *c = batch->next;
+  command->opcode = c[0];
+  command->channel = c[1];
+  command->value = 0;
+  command->transition_ms = 0;
+  if (command->opcode == CMD_SET) {
+    command->value = c[2];
+  } else if (command->opcode == CMD_FADE) {
+    command->value = (uint16_t)c[2] << 8 | c[3];
+    command->transition_ms = (uint16_t)c[4] << 8 | c[5];
+  } else if (command->opcode == CMD_EFFECT) {
+    command->mode = c[2];
+    command->period_ms = (uint16_t)c[3] << 8 | c[4];
+    command->duty = c[5];
+    command->phase = c[6];
+  }
+  batch->next += command_size(command->opcode);
+  return true;
+}
+
+size_t command_encode_ack(unsigned char *buf, uint16_t sequence, unsigned char status, const struct CommandResult *results, size_t result_count) {
+  buf[0] = CMD_VERSION;
+  buf[1] = CMD_ACK;
+  buf[2] = sequence >> 8;
+  buf[3] = sequence;
+  buf[4] = status;
+  buf[5] = result_count;
+  unsigned char *c = &buf[CMD_ACK_HEADER_SIZE];
+  for (size_t i = 0; i < result_count; ++i) {
+    c[0] = results[i].channel;
+    c[1] = results[i].level >> 8;
+    c[2] = results[i].level;
+    c += CMD_RESULT_SIZE;
+  }
+  return c - buf;
+}
+
+void command_encode_state(unsigned char *buf, const struct CommandState *state) {
+  buf[0] = CMD_VERSION;
+  buf[1] = CMD_STATE;
+  buf[2] = state->on;
+  buf[3] = state->level >> 8;
+  buf[4] = state->level;
+  buf[5] = state->mode;
+  buf[6] = state->period_ms >> 8;
+  buf[7] = state->period_ms;
+  buf[8] = state->duty;
+  buf[9] = state->phase;
+  encode_u32(&buf[10], state->version);
+}
+
+void command_encode_sync(unsigned char *buf, uint32_t epoch, uint32_t version, unsigned char count, bool snapshot) {
+  buf[0] = CMD_VERSION;
+  buf[1] = CMD_SYNC;
+  encode_u32(&buf[2], epoch);
+  encode_u32(&buf[6], version);
+  buf[10] = count;
+  buf[11] = snapshot;
+}
+
+size_t command_encode_boot_timeline(unsigned char *buf, const uint64_t *times_us, unsigned char count) {
+  buf[0] = CMD_VERSION;
+  buf[1] = CMD_BOOT_TIMELINE;
+  buf[2] = count;
+  unsigned char *c = &buf[CMD_BOOT_TIMELINE_HEADER_SIZE];
+  for (size_t i = 0; i < count; ++i) {
+    encode_u32(c, times_us[i] > UINT32_MAX ? UINT32_MAX : times_us[i]);
+    c += 4;
+  }
+  return c - buf;
+}
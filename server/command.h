@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary command batches carried in a single WebSocket BINARY message. All
+// multi-byte fields are big-endian.
+//
+// Batch:  version (1) | sequence (2) | command count (1) | commands...
+// Commands:
+//   SET     opcode (1) | channel (1) | on (1)
+//   TOGGLE  opcode (1) | channel (1)
+//   QUERY   opcode (1) | channel (1)
+//   FADE    opcode (1) | channel (1) | level (2) | transition ms (2)
+//   EFFECT  opcode (1) | channel (1) | mode (1) | period ms (2) | duty (1) |
+//           phase (1)
+//   BOOT    opcode (1) | channel (1)
+//
+// A FADE to level 0 switches the channel off, any other level switches it on
+// at that brightness. SET and TOGGLE keep the last brightness. EFFECT starts
+// one of the CMD_MODE_* effects, rendered on the device until the next
+// EFFECT; duty and phase are in 1/256ths of the period.
+//
+// Every batch is answered with one acknowledgement carrying the current level
+// of the queried channels, 0 when off:
+// Ack:    version (1) | CMD_ACK (1) | sequence (2) | status (1) |
+//         result count (1) | (channel (1) | level (2))...
+//
+// A batch is validated as a whole before any of it is applied, so a rejected
+// batch changes nothing.
+//
+// Whenever the state changes the server sends every client:
+// State:  version (1) | CMD_STATE (1) | on (1) | level (2) | mode (1) |
+//         period ms (2) | duty (1) | phase (1) | state version (4)
+//
+// The state version increases by one with every change. After the handshake
+// a client is sent a sync message followed by count state messages, oldest
+// first:
+// Sync:   version (1) | CMD_SYNC (1) | epoch (4) | state version (4) |
+//         count (1) | snapshot (1)
+// A client that opens the WebSocket with "/?epoch=E&version=V", the epoch of
+// its last sync and the last state version it saw, is sent the states it
+// missed, none if it is up to date. Otherwise, or if they are no longer
+// available, it is sent the current state alone with snapshot set.
+//
+// A BOOT command has the acknowledgement followed by the boot timeline, when
+// each boot phase completed in microseconds since reset, 0 if it has not:
+// Boot:   version (1) | CMD_BOOT_TIMELINE (1) | phase count (1) |
+//         time us (4)...
+// Times that do not fit in 32 bits are sent as 0xFFFFFFFF.
+
+#define CMD_VERSION 2
+#define CMD_HEADER_SIZE 4
+#define CMD_ACK_HEADER_SIZE 6
+#define CMD_MAX_RESULTS 64
+#define CMD_RESULT_SIZE 3
+#define CMD_ACK_MAX_SIZE (CMD_ACK_HEADER_SIZE + CMD_RESULT_SIZE * CMD_MAX_RESULTS)
+
+#define CMD_SET 0x01
+#define CMD_TOGGLE 0x02
+#define CMD_QUERY 0x03
+#define CMD_FADE 0x04
+#define CMD_EFFECT 0x05
+#define CMD_BOOT 0x06
+#define CMD_ACK 0x80
+#define CMD_STATE 0x81
+#define CMD_SYNC 0x82
+#define CMD_BOOT_TIMELINE 0x83
+
+#define CMD_MODE_STEADY 0
+#define CMD_MODE_BLINK 1
+#define CMD_MODE_BREATHE 2
+#define CMD_MODE_STROBE 3
+#define CMD_MODE_CHASE 4
+#define CMD_MODE_COUNT 5
+
+#define CMD_STATE_SIZE 14
+#define CMD_SYNC_SIZE 12
+#define CMD_BOOT_TIMELINE_HEADER_SIZE 3
+
+#define CMD_STATUS_OK 0
+#define CMD_STATUS_BAD_VERSION 1
+#define CMD_STATUS_MALFORMED 2
+#define CMD_STATUS_BAD_CHANNEL 3
+#define CMD_STATUS_TOO_MANY_RESULTS 4
+#define CMD_STATUS_BAD_VALUE 5
+
+struct Command {
+  unsigned char opcode;
+  unsigned char channel;
+  uint16_t value;
+  uint16_t transition_ms;
+  unsigned char mode;
+  unsigned char duty;
+  unsigned char phase;
+  uint16_t period_ms;
+};
+
+struct CommandResult {
+  unsigned char channel;
+  uint16_t level;
+};
+
+struct CommandState {
+  uint32_t version;
+  bool on;
+  uint16_t level;
+  unsigned char mode;
+  uint16_t period_ms;
+  unsigned char duty;
+  unsigned char phase;
+};
+
+struct CommandBatch {
+  uint16_t sequence;
+  unsigned char count;
+  const unsigned char *next;
+  const unsigned char *end;
+};
+
+// Validates a batch against the number of channels the device has and
+// prepares it for iteration. Returns one of the CMD_STATUS_* codes. The
+// sequence number is filled in whenever the header could be read.
+int command_batch_open(struct CommandBatch *batch, const unsigned char *payload, size_t length, size_t channel_count);
+
+// Returns the next command of an opened batch, or false once all have been
+// returned.
+bool command_batch_next(struct CommandBatch *batch, struct Command *command);
+
+// Writes an acknowledgement to buf, which must hold CMD_ACK_MAX_SIZE bytes.
+// Returns its length.
+size_t command_encode_ack(unsigned char *buf, uint16_t sequence, unsigned char status, const struct CommandResult *results, size_t result_count);
+
+// Writes a state message of CMD_STATE_SIZE bytes to buf.
+void command_encode_state(unsigned char *buf, const struct CommandState *state);
+
+// Writes a sync message of CMD_SYNC_SIZE bytes to buf.
+void command_encode_sync(unsigned char *buf, uint32_t epoch, uint32_t version, unsigned char count, bool snapshot);
+
+// Writes a boot timeline message of CMD_BOOT_TIMELINE_HEADER_SIZE + 4 * count
+// bytes to buf. Returns its length.
+size_t command_encode_boot_timeline(unsigned char *buf, const uint64_t *times_us, unsigned char count);
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/time.h"
+
+#include "connection.h"
+#include "log.h"
+
+struct Connection connections[MAX_CONNECTIONS];
+
+struct Connection *connection_alloc(struct tcp_pcb *pcb) {
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+    struct Connection *connection = &connections[i];
+    if (connection->state != FREE)
+      continue;
+    connection->state = HANDSHAKE;
+    connection->pcb = pcb;
+    http_parser_init(&connection->parser, (char *)connection->request_buf, REQUEST_BUF_SIZE);
+    connection->request_start_us = time_us_64();
+    connection->last_activity_us = connection->request_start_us;
+    connection->ping_outstanding = false;
+    connection->reply_pending = false;
+    connection->resync_pending = false;
+    tcp_arg(pcb, connection);
+    return connection;
+  }
+  return NULL;
+}
+
+void connection_release(struct Connection *connection) {
+  connection->state = FREE;
+  connection->pcb = NULL;
+}
+
+static void detach(struct tcp_pcb *pcb) {
+  tcp_arg(pcb, NULL);
+  tcp_recv(pcb, NULL);
+  tcp_err(pcb, NULL);
+  tcp_sent(pcb, NULL);
+  tcp_poll(pcb, NULL, 0);
+}
+
+err_t connection_abort(struct Connection *connection) {
+  if (connection->pcb) {
+    detach(connection->pcb);
+    tcp_abort(connection->pcb);
+  }
+  connection_release(connection);
+  return ERR_ABRT;
+}
+
+err_t connection_close(struct Connection *connection) {
+  struct tcp_pcb *pcb = connection->pcb;
+  err_t err = ERR_OK;
+  if (pcb) {
+    detach(pcb);
+    if (tcp_close(pcb) != ERR_OK) {
+      LOG_WARN("Failed to close connection, aborting.");
+      tcp_abort(pcb);
+      err = ERR_ABRT;
+    }
+  }
+  connection_release(connection);
+  return err;
+}
+
+size_t connection_broadcast(const void *data, u16_t length) {
+  size_t sent = 0;
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i) {
+    struct Connection *connection = &connections[i];
+    if (connection->state != ONLINE)
+      continue;
+    connection->resync_pending = tcp_write(connection->pcb, data, length, TCP_WRITE_FLAG_COPY) != ERR_OK;
+    if (connection->resync_pending)
+      continue;
+    tcp_output(connection->pcb);
+    ++sent;
+  }
+  return sent;
+}
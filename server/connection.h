@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/tcp.h"
+
+#include "http.h"
+#include "ws.h"
+
+#define MAX_CONNECTIONS 8
+#define REQUEST_BUF_SIZE 512
+
+// Connections speak HTTP in the HANDSHAKE state, answering REST requests
+// until one of them upgrades the connection to a WebSocket.
+enum ConnectionState {
+  FREE,
+  HANDSHAKE,
+  ONLINE,
+};
+
+struct Connection {
+  enum ConnectionState state;
+  struct tcp_pcb *pcb;
+  unsigned char request_buf[REQUEST_BUF_SIZE];
+  // Liveness bookkeeping for the poll timer, in time_us_64 timestamps.
+  uint64_t request_start_us;
+  uint64_t last_activity_us;
+  uint64_t ping_sent_us;
+  bool ping_outstanding;
+  // The last command acknowledgement, timed until the peer acknowledges its
+  // last byte: when its batch was applied and the sequence number after it.
+  bool reply_pending;
+  uint64_t reply_start_us;
+  u32_t reply_end_seq;
+  // A state broadcast did not fit in the send buffer, so the client is behind
+  // until the current state is sent to it.
+  bool resync_pending;
+  // Before the upgrade request_buf holds the parts of the HTTP request the
+  // server needs, once ONLINE the message being reassembled.
+  union {
+    struct HttpParser parser;
+    struct WsDecoder decoder;
+  };
+};
+
+extern struct Connection connections[MAX_CONNECTIONS];
+
+// Claims a free slot for a newly accepted pcb and registers the connection as
+// the pcb's callback argument. Returns NULL if the table is full.
+struct Connection *connection_alloc(struct tcp_pcb *pcb);
+
+// Closes the pcb (aborting it if the close fails) and frees the slot. Returns
+// ERR_ABRT if the pcb was aborted, which must then be returned from the lwIP
+// callback that called this.
+err_t connection_close(struct Connection *connection);
+
+// Aborts the pcb with a reset, which frees it immediately, and frees the
+// slot. Always returns ERR_ABRT.
+err_t connection_abort(struct Connection *connection);
+
+// Frees the slot of a connection whose pcb lwIP has already deallocated.
+void connection_release(struct Connection *connection);
+
+// Queues a copy of the current state frame on every ONLINE connection. lwIP
+// keeps unacknowledged data for retransmission long after the call, so it is
+// always copied: a buffer shared by reference would carry whatever was written
+// to it last. A connection without room for it is marked for a resync instead,
+// and one with room no longer needs one. Returns the number of connections the
+// frame was queued on.
+size_t connection_broadcast(const void *data, u16_t length);
@@ -0,0 +1,11 @@
+#include "crc32.h"
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t length) {
+  const unsigned char *c = data;
+  for (size_t i = 0; i < length; ++i) {
+    crc ^= c[i];
+    for (int bit = 0; bit < 8; ++bit)
+      crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+  }
+  return crc;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3) for the records kept in flash, computed bit by bit to
+// stay small; the records are only checked at boot and when written.
+
+#define CRC32_INIT 0xFFFFFFFF
+
+// Continues a CRC over more data. Start from CRC32_INIT and invert the result.
+uint32_t crc32_update(uint32_t crc, const void *data, size_t length);
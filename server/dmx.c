@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "dmx.h"
+
+// E1.31 data packet layout (ANSI E1.31-2018, section 4).
+#define E131_ACN_ID_OFFSET 4
+#define E131_ROOT_VECTOR_OFFSET 18
+#define E131_FRAMING_VECTOR_OFFSET 40
+#define E131_SEQUENCE_OFFSET 111
+#define E131_OPTIONS_OFFSET 112
+#define E131_UNIVERSE_OFFSET 113
+#define E131_DMP_VECTOR_OFFSET 117
+#define E131_ADDRESS_TYPE_OFFSET 118
+#define E131_VALUE_COUNT_OFFSET 123
+#define E131_START_CODE_OFFSET 125
+#define E131_HEADER_SIZE 126
+#define E131_ROOT_VECTOR_DATA 0x00000004
+#define E131_FRAMING_VECTOR_DATA 0x00000002
+#define E131_DMP_VECTOR_SET_PROPERTY 0x02
+#define E131_ADDRESS_TYPE 0xA1
+#define E131_OPTION_PREVIEW 0x80
+#define E131_OPTION_TERMINATED 0x40
+
+// ArtDmx layout (Art-Net 4).
+#define ARTNET_OPCODE_OFFSET 8
+#define ARTNET_SEQUENCE_OFFSET 12
+#define ARTNET_SUBUNI_OFFSET 14
+#define ARTNET_NET_OFFSET 15
+#define ARTNET_LENGTH_OFFSET 16
+#define ARTNET_HEADER_SIZE 18
+#define ARTNET_OP_DMX 0x5000
+
+#define DMX_START_CODE 0x00
+#define DMX_SEQUENCE_WINDOW 20
+
+static const unsigned char e131_acn_id[12] = "ASC-E1.17\0\0";
+static const unsigned char artnet_id[8] = "Art-Net";
+
+static uint32_t read32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t read16(const unsigned char *p) {
+  return (uint16_t)p[0] << 8 | p[1];
+}
+
+static enum DmxProtocol parse_e131(const unsigned char *packet, size_t length, struct DmxFrame *frame) {
+  if (length < E131_HEADER_SIZE
+      || memcmp(&packet[E131_ACN_ID_OFFSET], e131_acn_id, sizeof(e131_acn_id))
+      || read32(&packet[E131_ROOT_VECTOR_OFFSET]) != E131_ROOT_VECTOR_DATA
+      || read32(&packet[E131_FRAMING_VECTOR_OFFSET]) != E131_FRAMING_VECTOR_DATA
+      || packet[E131_DMP_VECTOR_OFFSET] != E131_DMP_VECTOR_SET_PROPERTY
+      || packet[E131_ADDRESS_TYPE_OFFSET] != E131_ADDRESS_TYPE)
+    return DMX_NONE;
+
+  unsigned char options = packet[E131_OPTIONS_OFFSET];
+  if (options & E131_OPTION_PREVIEW)
+    return DMX_NONE;
+
+  // The property value count includes the start code.
+  size_t values = read16(&packet[E131_VALUE_COUNT_OFFSET]);
+  if (values == 0 || values - 1 > DMX_MAX_SLOTS || E131_START_CODE_OFFSET + values > length
+      || packet[E131_START_CODE_OFFSET] != DMX_START_CODE)
+    return DMX_NONE;
+
+  frame->protocol = DMX_E131;
+  frame->universe = read16(&packet[E131_UNIVERSE_OFFSET]);
+  frame->sequence = packet[E131_SEQUENCE_OFFSET];
+  frame->terminated = options & E131_OPTION_TERMINATED;
+  frame->slots = &packet[E131_HEADER_SIZE];
+  frame->slot_count = values - 1;
+  return DMX_E131;
+}
+
+static enum DmxProtocol parse_artnet(const unsigned char *packet, size_t length, struct DmxFrame *frame) {
+  // The opcode is little-endian, unlike the rest of the packet.
+  if (length < ARTNET_HEADER_SIZE || memcmp(packet, artnet_id, sizeof(artnet_id))
+      || (packet[ARTNET_OPCODE_OFFSET] | packet[ARTNET_OPCODE_OFFSET + 1] << 8) != ARTNET_OP_DMX)
+    return DMX_NONE;
+
+  size_t slots = read16(&packet[ARTNET_LENGTH_OFFSET]);
+  if (slots > DMX_MAX_SLOTS || ARTNET_HEADER_SIZE + slots > length)
+    return DMX_NONE;
+
+  frame->protocol = DMX_ARTNET;
+  frame->universe = (uint16_t)(packet[ARTNET_NET_OFFSET] & 0x7F) << 8 | packet[ARTNET_SUBUNI_OFFSET];
+  frame->sequence = packet[ARTNET_SEQUENCE_OFFSET];
+  frame->terminated = false;
+  frame->slots = &packet[ARTNET_HEADER_SIZE];
+  frame->slot_count = slots;
+  return DMX_ARTNET;
+}
+
+enum DmxProtocol dmx_parse(const unsigned char *packet, size_t length, struct DmxFrame *frame) {
+  frame->protocol = DMX_NONE;
+  if (length >= 1 && packet[0] == 'A')
+    return parse_artnet(packet, length, frame);
+  return parse_e131(packet, length, frame);
+}
+
+bool dmx_sequence_accept(struct DmxSequence *sequence, const struct DmxFrame *frame) {
+  if (frame->protocol == DMX_ARTNET && frame->sequence == 0)
+    return true;
+  if (sequence->valid) {
+    int8_t difference = (int8_t)(frame->sequence - sequence->last);
+    if (difference <= 0 && difference > -DMX_SEQUENCE_WINDOW)
+      return false;
+  }
+  sequence->valid = !frame->terminated;
+  sequence->last = frame->sequence;
+  return !frame->terminated;
+}
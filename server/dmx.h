@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Parsing of DMX512 frames streamed over UDP, as E1.31 (sACN) data packets or
+// Art-Net ArtDmx packets. Kept free of lwIP so that it can be built on the
+// host.
+
+#define E131_PORT 5568
+#define ARTNET_PORT 6454
+#define DMX_MAX_SLOTS 512
+// An E1.31 data packet with all 512 slots; ArtDmx packets are smaller.
+#define DMX_MAX_PACKET_SIZE (126 + DMX_MAX_SLOTS)
+
+enum DmxProtocol {
+  DMX_NONE,
+  DMX_E131,
+  DMX_ARTNET,
+};
+
+struct DmxFrame {
+  enum DmxProtocol protocol;
+  uint16_t universe;
+  uint8_t sequence;
+  // The source is shutting the stream down (E1.31 only); carries no data.
+  bool terminated;
+  // Slot values, pointing into the parsed packet. slots[0] is DMX slot 1.
+  const unsigned char *slots;
+  size_t slot_count;
+};
+
+// Parses an E1.31 data packet or an ArtDmx packet. Returns the protocol, or
+// DMX_NONE for anything else, including preview data, non-zero start codes
+// and other Art-Net opcodes.
+enum DmxProtocol dmx_parse(const unsigned char *packet, size_t length, struct DmxFrame *frame);
+
+// Tracks the sequence number of one stream. Both protocols use an 8-bit
+// counter that wraps; Art-Net sources that do not sequence send 0.
+struct DmxSequence {
+  bool valid;
+  uint8_t last;
+};
+
+// Returns whether the frame should be applied. Frames less than 20 behind the
+// last one are late or duplicated and are dropped; anything further back is
+// taken as a restarted source, as E1.31 specifies. A terminated E1.31 stream
+// is not applied and the next frame starts it over.
+bool dmx_sequence_accept(struct DmxSequence *sequence, const struct DmxFrame *frame);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware/sync.h"
+
+// Ring for handing work from interrupt handlers to the main loop. Several
+// handlers push, and one may preempt another, so a push claims its slot with
+// interrupts disabled. Only the main loop pops, and only it writes tail.
+
+#define EVENT_RING_SIZE 16
+
+enum EventType {
+  EVENT_BUTTON,
+  EVENT_CONSOLE,
+};
+
+struct Event {
+  enum EventType type;
+  // When the interrupt fired and when it finished its own part of the work.
+  uint64_t time_us;
+  uint64_t handled_us;
+};
+
+struct EventRing {
+  struct Event events[EVENT_RING_SIZE];
+  atomic_uint head;
+  atomic_uint tail;
+  // Events lost because the ring was full. Written by pushes only.
+  atomic_uint dropped;
+};
+
+static inline bool event_ring_push(struct EventRing *ring, const struct Event *event) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail == EVENT_RING_SIZE) {
+    // A plain load and store, as the Cortex-M0+ has no atomic read-modify-write.
+    unsigned dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    atomic_store_explicit(&ring->dropped, dropped + 1, memory_order_relaxed);
+    restore_interrupts(interrupts);
+    return false;
+  }
+  ring->events[head % EVENT_RING_SIZE] = *event;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  restore_interrupts(interrupts);
+  return true;
+}
+
+static inline bool event_ring_pop(struct EventRing *ring, struct Event *event) {
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (head == tail)
+    return false;
+  *event = ring->events[tail % EVENT_RING_SIZE];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
@@ -0,0 +1,34 @@
+#include <stdio.h>
+
+#include "histogram.h"
+
+uint32_t histogram_bucket_limit(unsigned bucket) {
+  return bucket < HISTOGRAM_BUCKETS - 1 ? 1u << bucket : UINT32_MAX;
+}
+
+uint32_t histogram_percentile(const struct Histogram *histogram, unsigned percent) {
+  // The rank is rounded up, so that the 100th percentile is the last sample.
+  uint64_t rank = ((uint64_t)histogram->total * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+    seen += histogram->counts[bucket];
+    if (seen && seen >= rank)
+      return histogram_bucket_limit(bucket);
+  }
+  return 0;
+}
+
+void histogram_print(const struct Histogram *histogram, const char *name) {
+  printf("%s: %lu samples, p50 < %lu us, p90 < %lu us, p99 < %lu us, max %lu us\n", name,
+         (unsigned long)histogram->total, (unsigned long)histogram_percentile(histogram, 50),
+         (unsigned long)histogram_percentile(histogram, 90), (unsigned long)histogram_percentile(histogram, 99),
+         (unsigned long)histogram->max_us);
+  for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+    if (!histogram->counts[bucket])
+      continue;
+    if (bucket < HISTOGRAM_BUCKETS - 1)
+      printf("  < %lu us: %lu\n", (unsigned long)histogram_bucket_limit(bucket), (unsigned long)histogram->counts[bucket]);
+    else
+      printf("  >= %lu us: %lu\n", (unsigned long)histogram_bucket_limit(bucket - 1), (unsigned long)histogram->counts[bucket]);
+  }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// Latency histogram with fixed power of two buckets in microseconds, cheap
+// enough to record every request in production. Bucket 0 counts 0 us,
+// bucket i counts [2^(i-1), 2^i) us and the last bucket everything above.
+
+#define HISTOGRAM_BUCKETS 24
+
+struct Histogram {
+  uint32_t counts[HISTOGRAM_BUCKETS];
+  uint32_t total;
+  uint32_t max_us;
+};
+
+static inline void histogram_record(struct Histogram *histogram, uint32_t us) {
+  // The SDK routes __builtin_clz to the boot ROM, so this is safe to call
+  // from code running in RAM.
+  unsigned bucket = us ? 32 - __builtin_clz(us) : 0;
+  if (bucket >= HISTOGRAM_BUCKETS)
+    bucket = HISTOGRAM_BUCKETS - 1;
+  ++histogram->counts[bucket];
+  ++histogram->total;
+  if (us > histogram->max_us)
+    histogram->max_us = us;
+}
+
+// Exclusive upper bound of a bucket in microseconds, UINT32_MAX for the last.
+uint32_t histogram_bucket_limit(unsigned bucket);
+
+// Returns the upper bound of the bucket holding the given percentile, 0 if
+// nothing has been recorded.
+uint32_t histogram_percentile(const struct Histogram *histogram, unsigned percent);
+
+// Prints the count, percentiles and maximum, then the non-empty buckets.
+void histogram_print(const struct Histogram *histogram, const char *name);
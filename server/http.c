@@ -0,0 +1,383 @@
+#include <string.h>
+
+#include "http.h"
+
+enum {
+  HEADER_NONE = -1,
+  HEADER_CONNECTION,
+  HEADER_UPGRADE,
+  HEADER_WEBSOCKET_KEY,
+  HEADER_CONTENT_LENGTH,
+  HEADER_TRANSFER_ENCODING,
+  HEADER_COUNT,
+};
+
+#define HEADER_NAME(name) {name, sizeof(name) - 1}
+
+static const struct {
+  const char *name;
+  size_t length;
+} header_names[HEADER_COUNT] = {
+  [HEADER_CONNECTION] = HEADER_NAME("connection"),
+  [HEADER_UPGRADE] = HEADER_NAME("upgrade"),
+  [HEADER_WEBSOCKET_KEY] = HEADER_NAME("sec-websocket-key"),
+  [HEADER_CONTENT_LENGTH] = HEADER_NAME("content-length"),
+  [HEADER_TRANSFER_ENCODING] = HEADER_NAME("transfer-encoding"),
+};
+
+#define ALL_HEADERS ((1u << HEADER_COUNT) - 1)
+// Content-Length values beyond this are rejected long before they overflow.
+#define MAX_CONTENT_LENGTH 0xFFFFFF
+
+static char lower(char c) {
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// The characters of a header name (tchar in RFC 9110), a bit for each
+// ASCII character.
+static const uint32_t token_chars[4] = {0x00000000, 0x03FF6CFA, 0xC7FFFFFE, 0x57FFFFFF};
+
+static bool is_token_char(char c) {
+  unsigned char u = c;
+  return u < 128 && (token_chars[u >> 5] >> (u & 31) & 1);
+}
+
+void http_parser_init(struct HttpParser *parser, char *buf, size_t capacity) {
+  memset(parser, 0, sizeof(*parser));
+  parser->state = HTTP_STATE_METHOD;
+  parser->buf = buf;
+  parser->capacity = capacity;
+}
+
+static bool store(struct HttpParser *parser, char c) {
+  if (parser->length == parser->capacity)
+    return false;
+  parser->buf[parser->length++] = c;
+  return true;
+}
+
+static bool end_request_line(struct HttpParser *parser) {
+  struct HttpRequest *request = &parser->request;
+  if (parser->method_length == 3 && !memcmp(parser->method, "GET", 3))
+    request->method = HTTP_GET;
+  else if (parser->method_length == 3 && !memcmp(parser->method, "PUT", 3))
+    request->method = HTTP_PUT;
+  else
+    request->method = HTTP_OTHER;
+  return parser->version_length == 8 && !memcmp(parser->version, "HTTP/1.", 7)
+         && (parser->version[7] == '0' || parser->version[7] == '1');
+}
+
+// Narrows down the known headers the name can still be, a character at a time.
+// A name longer than a candidate rules it out.
+static void match_name(struct HttpParser *parser, char c) {
+  c = lower(c);
+  for (int i = 0; i < HEADER_COUNT; ++i) {
+    if ((parser->candidates & 1u << i)
+        && (parser->name_length >= header_names[i].length || header_names[i].name[parser->name_length] != c))
+      parser->candidates &= ~(1u << i);
+  }
+  ++parser->name_length;
+}
+
+static int end_name(struct HttpParser *parser) {
+  parser->header = HEADER_NONE;
+  for (int i = 0; i < HEADER_COUNT; ++i) {
+    if ((parser->candidates & 1u << i) && parser->name_length == header_names[i].length)
+      parser->header = i;
+  }
+  parser->value_started = false;
+  parser->token_length = 0;
+  parser->value_spaces = 0;
+
+  switch (parser->header) {
+  case HEADER_WEBSOCKET_KEY:
+    // A repeated key replaces the previous one, which is left unused.
+    parser->request.websocket_key = &parser->buf[parser->length];
+    parser->request.websocket_key_length = 0;
+    break;
+  case HEADER_CONTENT_LENGTH:
+    if (parser->has_content_length)
+      return HTTP_PARSE_ERROR;
+    parser->has_content_length = true;
+    break;
+  case HEADER_TRANSFER_ENCODING:
+    // Chunked bodies are not supported.
+    return HTTP_PARSE_ERROR;
+  }
+  return HTTP_PARSE_INCOMPLETE;
+}
+
+static void end_token(struct HttpParser *parser) {
+  const char *token = parser->token;
+  size_t length = parser->token_length;
+  parser->token_length = 0;
+  if (length > HTTP_MAX_TOKEN_SIZE)
+    return;
+  if (parser->header == HEADER_CONNECTION) {
+    if (length == 5 && !memcmp(token, "close", 5))
+      parser->connection_close = true;
+    else if (length == 10 && !memcmp(token, "keep-alive", 10))
+      parser->connection_keep_alive = true;
+    else if (length == 7 && !memcmp(token, "upgrade", 7))
+      parser->connection_upgrade = true;
+  } else if (parser->header == HEADER_UPGRADE) {
+    if (length == 9 && !memcmp(token, "websocket", 9))
+      parser->upgrade_websocket = true;
+  }
+}
+
+static int value_char(struct HttpParser *parser, char c) {
+  bool space = c == ' ' || c == '\t';
+  if (space && !parser->value_started)
+    return HTTP_PARSE_INCOMPLETE;
+  parser->value_started = true;
+
+  switch (parser->header) {
+  case HEADER_CONNECTION:
+  case HEADER_UPGRADE:
+    // Comma separated, case-insensitive tokens.
+    if (c == ',') {
+      end_token(parser);
+    } else if (!space) {
+      if (parser->token_length < HTTP_MAX_TOKEN_SIZE)
+        parser->token[parser->token_length] = lower(c);
+      if (parser->token_length <= HTTP_MAX_TOKEN_SIZE)
+        ++parser->token_length;
+    }
+    break;
+  case HEADER_WEBSOCKET_KEY:
+    // Trailing whitespace is trimmed at the end of the line.
+    if (!store(parser, c))
+      return HTTP_PARSE_TOO_LARGE;
+    ++parser->request.websocket_key_length;
+    break;
+  case HEADER_CONTENT_LENGTH:
+    if (space) {
+      ++parser->value_spaces;
+    } else if (c >= '0' && c <= '9' && !parser->value_spaces) {
+      parser->request.content_length = parser->request.content_length * 10 + (c - '0');
+      if (parser->request.content_length > MAX_CONTENT_LENGTH)
+        return HTTP_PARSE_ERROR;
+    } else {
+      return HTTP_PARSE_ERROR;
+    }
+    break;
+  }
+  return HTTP_PARSE_INCOMPLETE;
+}
+
+static int end_value(struct HttpParser *parser) {
+  switch (parser->header) {
+  case HEADER_CONNECTION:
+  case HEADER_UPGRADE:
+    end_token(parser);
+    break;
+  case HEADER_WEBSOCKET_KEY:
+    while (parser->request.websocket_key_length > 0
+           && (parser->buf[parser->length - 1] == ' ' || parser->buf[parser->length - 1] == '\t')) {
+      --parser->request.websocket_key_length;
+      --parser->length;
+    }
+    break;
+  case HEADER_CONTENT_LENGTH:
+    if (!parser->value_started)
+      return HTTP_PARSE_ERROR;
+    break;
+  }
+  return HTTP_PARSE_INCOMPLETE;
+}
+
+static int end_head(struct HttpParser *parser) {
+  struct HttpRequest *request = &parser->request;
+  bool http_1_1 = parser->version[7] == '1';
+  request->keep_alive = http_1_1 ? !parser->connection_close : parser->connection_keep_alive;
+  request->upgrade_websocket = parser->connection_upgrade && parser->upgrade_websocket;
+  request->body = &parser->buf[parser->length];
+  if (request->content_length > parser->capacity - parser->length)
+    return HTTP_PARSE_TOO_LARGE;
+  if (request->content_length == 0) {
+    parser->state = HTTP_STATE_DONE;
+    return HTTP_PARSE_DONE;
+  }
+  parser->state = HTTP_STATE_BODY;
+  return HTTP_PARSE_INCOMPLETE;
+}
+
+// Advances the parser by one byte of the request head.
+static int head_char(struct HttpParser *parser, char c) {
+  struct HttpRequest *request = &parser->request;
+  bool line_end = c == '\r' || c == '\n';
+
+  switch (parser->state) {
+  case HTTP_STATE_METHOD:
+    if (c == ' ') {
+      if (parser->method_length == 0)
+        return HTTP_PARSE_ERROR;
+      request->target = &parser->buf[parser->length];
+      parser->state = HTTP_STATE_TARGET;
+    } else if (line_end) {
+      return HTTP_PARSE_ERROR;
+    } else {
+      if (parser->method_length < sizeof(parser->method))
+        parser->method[parser->method_length] = c;
+      if (parser->method_length <= sizeof(parser->method))
+        ++parser->method_length;
+    }
+    break;
+
+  case HTTP_STATE_TARGET:
+    if (c == ' ') {
+      if (request->target_length == 0)
+        return HTTP_PARSE_ERROR;
+      parser->state = HTTP_STATE_VERSION;
+    } else if (line_end) {
+      return HTTP_PARSE_ERROR;
+    } else {
+      if (!store(parser, c))
+        return HTTP_PARSE_TOO_LARGE;
+      ++request->target_length;
+    }
+    break;
+
+  case HTTP_STATE_VERSION:
+    if (line_end) {
+      if (!end_request_line(parser))
+        return HTTP_PARSE_ERROR;
+      parser->state = c == '\r' ? HTTP_STATE_LINE_END : HTTP_STATE_HEADER_START;
+    } else {
+      if (parser->version_length < sizeof(parser->version))
+        parser->version[parser->version_length] = c;
+      if (parser->version_length <= sizeof(parser->version))
+        ++parser->version_length;
+    }
+    break;
+
+  case HTTP_STATE_LINE_END:
+    if (c != '\n')
+      return HTTP_PARSE_ERROR;
+    parser->state = HTTP_STATE_HEADER_START;
+    break;
+
+  case HTTP_STATE_HEADER_START:
+    if (c == '\r') {
+      parser->state = HTTP_STATE_HEAD_END;
+      break;
+    }
+    if (c == '\n')
+      return end_head(parser);
+    // Obsolete line folding is not supported.
+    if (!is_token_char(c))
+      return HTTP_PARSE_ERROR;
+    parser->candidates = ALL_HEADERS;
+    parser->name_length = 0;
+    parser->state = HTTP_STATE_HEADER_NAME;
+    match_name(parser, c);
+    break;
+
+  case HTTP_STATE_HEADER_NAME:
+    if (c == ':') {
+      parser->state = HTTP_STATE_HEADER_VALUE;
+      return end_name(parser);
+    }
+    if (!is_token_char(c))
+      return HTTP_PARSE_ERROR;
+    match_name(parser, c);
+    break;
+
+  case HTTP_STATE_HEADER_VALUE:
+    if (line_end) {
+      parser->state = c == '\r' ? HTTP_STATE_LINE_END : HTTP_STATE_HEADER_START;
+      return end_value(parser);
+    }
+    return value_char(parser, c);
+
+  case HTTP_STATE_HEAD_END:
+    if (c != '\n')
+      return HTTP_PARSE_ERROR;
+    return end_head(parser);
+
+  default:
+    break;
+  }
+  return HTTP_PARSE_INCOMPLETE;
+}
+
+int http_parse(struct HttpParser *parser, const char *data, size_t length, size_t *consumed, const struct HttpRequest **request) {
+  const char *c = data, *end = data + length;
+  int status = parser->state == HTTP_STATE_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_INCOMPLETE;
+
+  while (c < end && status == HTTP_PARSE_INCOMPLETE) {
+    if (parser->state == HTTP_STATE_BODY) {
+      // end_head has made sure that the body fits.
+      size_t remaining = parser->request.body + parser->request.content_length - &parser->buf[parser->length];
+      size_t n = remaining < (size_t)(end - c) ? remaining : (size_t)(end - c);
+      memcpy(&parser->buf[parser->length], c, n);
+      parser->length += n;
+      c += n;
+      if (n == remaining) {
+        parser->state = HTTP_STATE_DONE;
+        status = HTTP_PARSE_DONE;
+      }
+      continue;
+    }
+
+    // Headers the server ignores are skipped in tight loops: the rest of the
+    // name once it matches no known header, and the value up to the end of
+    // the line.
+    const char *skip_end = c;
+    if (parser->state == HTTP_STATE_HEADER_NAME && parser->candidates == 0) {
+      while (skip_end < end && is_token_char(*skip_end))
+        ++skip_end;
+    } else if (parser->state == HTTP_STATE_HEADER_VALUE && parser->header == HEADER_NONE) {
+      skip_end = memchr(c, '\n', end - c);
+      if (!skip_end)
+        skip_end = end;
+    }
+    if (skip_end != c) {
+      parser->head_length += skip_end - c;
+      c = skip_end;
+      if (parser->head_length > HTTP_MAX_HEAD_SIZE)
+        status = HTTP_PARSE_TOO_LARGE;
+      continue;
+    }
+
+    if (++parser->head_length > HTTP_MAX_HEAD_SIZE)
+      status = HTTP_PARSE_TOO_LARGE;
+    else
+      status = head_char(parser, *c++);
+  }
+
+  *consumed = c - data;
+  *request = &parser->request;
+  return status;
+}
+
+bool http_target_is(const struct HttpRequest *request, const char *path) {
+  const char *query = memchr(request->target, '?', request->target_length);
+  size_t length = query ? (size_t)(query - request->target) : request->target_length;
+  return length == strlen(path) && !memcmp(request->target, path, length);
+}
+
+bool http_query_uint(const struct HttpRequest *request, const char *name, uint32_t *value) {
+  const char *end = request->target + request->target_length;
+  const char *c = memchr(request->target, '?', request->target_length);
+  size_t name_length = strlen(name);
+  while (c && c < end) {
+    // Skip the '?' or '&' before the parameter.
+    const char *param = c + 1;
+    c = memchr(param, '&', end - param);
+    const char *param_end = c ? c : end;
+    if ((size_t)(param_end - param) <= name_length + 1 || memcmp(param, name, name_length) || param[name_length] != '=')
+      continue;
+    uint32_t result = 0;
+    for (const char *digit = &param[name_length + 1]; digit < param_end; ++digit) {
+      if (*digit < '0' || *digit > '9' || result > (UINT32_MAX - (uint32_t)(*digit - '0')) / 10)
+        return false;
+      result = result * 10 + (uint32_t)(*digit - '0');
+    }
+    *value = result;
+    return true;
+  }
+  return false;
+}
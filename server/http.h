@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental parsing of HTTP/1.1 requests for the REST endpoints and the
+// WebSocket upgrade. The parser is fed segments as they arrive, split at any
+// byte boundary, and looks at every byte once. Only the parts the server acts
+// on are kept, in a caller supplied buffer; the other headers are skipped
+// without being stored. Kept free of lwIP so that it can be built on the host.
+
+// Return values of http_parse.
+#define HTTP_PARSE_DONE 0
+#define HTTP_PARSE_INCOMPLETE 1
+#define HTTP_PARSE_ERROR 2
+#define HTTP_PARSE_TOO_LARGE 3
+
+// Longest request head accepted, including headers that are skipped.
+#define HTTP_MAX_HEAD_SIZE 8192
+#define HTTP_MAX_TOKEN_SIZE 16
+
+enum HttpMethod {
+  HTTP_GET,
+  HTTP_PUT,
+  HTTP_OTHER,
+};
+
+struct HttpRequest {
+  enum HttpMethod method;
+  const char *target;
+  size_t target_length;
+  // HTTP/1.1 connections persist unless the client asks to close them,
+  // HTTP/1.0 ones only when it asks for keep-alive.
+  bool keep_alive;
+  // Both "Connection: Upgrade" and "Upgrade: websocket" were sent.
+  bool upgrade_websocket;
+  const char *websocket_key;
+  size_t websocket_key_length;
+  const char *body;
+  size_t content_length;
+};
+
+enum HttpParserState {
+  HTTP_STATE_METHOD,
+  HTTP_STATE_TARGET,
+  HTTP_STATE_VERSION,
+  HTTP_STATE_LINE_END,
+  HTTP_STATE_HEADER_START,
+  HTTP_STATE_HEADER_NAME,
+  HTTP_STATE_HEADER_VALUE,
+  HTTP_STATE_HEAD_END,
+  HTTP_STATE_BODY,
+  HTTP_STATE_DONE,
+};
+
+struct HttpParser {
+  enum HttpParserState state;
+  // Storage for the target, WebSocket key and body of the request.
+  char *buf;
+  size_t capacity;
+  size_t length;
+  size_t head_length;
+
+  // Request line.
+  char method[8];
+  size_t method_length;
+  char version[8];
+  size_t version_length;
+
+  // Header being parsed: the known headers its name still matches, and the
+  // current token of a list valued header.
+  unsigned candidates;
+  size_t name_length;
+  int header;
+  bool value_started;
+  char token[HTTP_MAX_TOKEN_SIZE];
+  size_t token_length;
+  size_t value_spaces;
+
+  bool connection_close;
+  bool connection_keep_alive;
+  bool connection_upgrade;
+  bool upgrade_websocket;
+  bool has_content_length;
+
+  struct HttpRequest request;
+};
+
+// Prepares the parser for the next request, keeping what it needs in buf.
+void http_parser_init(struct HttpParser *parser, char *buf, size_t capacity);
+
+// Feeds the next bytes of the stream to the parser and sets consumed to the
+// number of bytes it used. Returns HTTP_PARSE_INCOMPLETE after consuming all
+// of them without completing the request. Returns HTTP_PARSE_DONE once the
+// request, head and body, is complete; the bytes after consumed belong to the
+// next pipelined request or to whatever protocol the request switched to.
+// request points into the parser and its buffer and stays valid until the
+// parser is initialised again.
+int http_parse(struct HttpParser *parser, const char *data, size_t length, size_t *consumed, const struct HttpRequest **request);
+
+// Compares the target against a path, ignoring any query string.
+bool http_target_is(const struct HttpRequest *request, const char *path);
+
+// Reads a decimal query parameter of the target, such as version in
+// "/?epoch=1&version=42". Returns false if it is missing or not a number that
+// fits in 32 bits.
+bool http_query_uint(const struct HttpRequest *request, const char *name, uint32_t *value);
@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+
+#include "crc32.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC 0x4A4C
+#define JOURNAL_END (JOURNAL_OFFSET + JOURNAL_SECTORS * FLASH_SECTOR_SIZE)
+
+struct JournalRecord {
+  uint16_t magic;
+  uint16_t size;
+  uint32_t sequence;
+  // Over size, sequence and the data.
+  uint32_t crc;
+  unsigned char data[JOURNAL_MAX_DATA_SIZE];
+};
+
+_Static_assert(sizeof(struct JournalRecord) == FLASH_PAGE_SIZE, "a record must fill a page");
+_Static_assert(JOURNAL_OFFSET % FLASH_SECTOR_SIZE == 0, "the journal must start on a sector");
+
+static const struct JournalRecord *record_at(uint32_t offset) {
+  return (const struct JournalRecord *)(XIP_BASE + offset);
+}
+
+static uint32_t record_crc(const struct JournalRecord *record) {
+  uint32_t crc = crc32_update(CRC32_INIT, &record->size, sizeof(record->size));
+  crc = crc32_update(crc, &record->sequence, sizeof(record->sequence));
+  return ~crc32_update(crc, record->data, record->size);
+}
+
+static bool record_valid(const struct JournalRecord *record) {
+  return record->magic == JOURNAL_MAGIC && record->size <= JOURNAL_MAX_DATA_SIZE && record->crc == record_crc(record);
+}
+
+static bool page_erased(uint32_t offset) {
+  const uint32_t *words = (const uint32_t *)(XIP_BASE + offset);
+  for (size_t i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); ++i) {
+    if (words[i] != 0xFFFFFFFF)
+      return false;
+  }
+  return true;
+}
+
+bool journal_load(struct Journal *journal, void *data, size_t size) {
+  const struct JournalRecord *latest = NULL;
+  uint32_t latest_offset = 0;
+  for (uint32_t offset = JOURNAL_OFFSET; offset < JOURNAL_END; offset += FLASH_PAGE_SIZE) {
+    const struct JournalRecord *record = record_at(offset);
+    // Sequence numbers are compared so that they may wrap.
+    if (record_valid(record) && (!latest || (int32_t)(record->sequence - latest->sequence) > 0)) {
+      latest = record;
+      latest_offset = offset;
+    }
+  }
+
+  if (!latest) {
+    journal->sequence = 0;
+    journal->next_offset = JOURNAL_OFFSET;
+    return false;
+  }
+  journal->sequence = latest->sequence;
+  journal->next_offset = latest_offset + FLASH_PAGE_SIZE;
+  if (latest->size != size)
+    return false;
+  memcpy(data, latest->data, size);
+  return true;
+}
+
+void journal_save(struct Journal *journal, const void *data, size_t size) {
+  static struct JournalRecord record;
+  memset(&record, 0xFF, sizeof(record));
+  record.magic = JOURNAL_MAGIC;
+  record.size = size;
+  record.sequence = journal->sequence + 1;
+  memcpy(record.data, data, size);
+  record.crc = record_crc(&record);
+
+  // Pages left over from an interrupted save are skipped. A record that starts
+  // a sector erases it first, while the current record is in the other one.
+  uint32_t offset = journal->next_offset;
+  while (offset % FLASH_SECTOR_SIZE != 0 && !page_erased(offset))
+    offset += FLASH_PAGE_SIZE;
+  if (offset == JOURNAL_END)
+    offset = JOURNAL_OFFSET;
+  bool erase = offset % FLASH_SECTOR_SIZE == 0;
+
+  uint32_t interrupts = save_and_disable_interrupts();
+  if (erase)
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+  flash_range_program(offset, (const uint8_t *)&record, FLASH_PAGE_SIZE);
+  restore_interrupts(interrupts);
+
+  journal->sequence = record.sequence;
+  journal->next_offset = offset + FLASH_PAGE_SIZE;
+}
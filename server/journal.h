@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/flash.h"
+
+// Power-fail-safe journal of a small record in flash, used to restore the LED
+// state after a reset. Each save programs the next page of one of two sectors
+// with a sequence number and a CRC; the record with the highest sequence and a
+// valid CRC is the current one. A save cut short by a power loss leaves a page
+// that fails its CRC and is skipped. A sector is only erased while the current
+// record is in the other one, so the previous record always survives.
+//
+// The journal sits just below the Wi-Fi credential sector at the end of flash.
+
+#define JOURNAL_SECTORS 2
+#define JOURNAL_OFFSET (PICO_FLASH_SIZE_BYTES - (1 + JOURNAL_SECTORS) * FLASH_SECTOR_SIZE)
+#define JOURNAL_HEADER_SIZE 12
+#define JOURNAL_MAX_DATA_SIZE (FLASH_PAGE_SIZE - JOURNAL_HEADER_SIZE)
+
+struct Journal {
+  uint32_t sequence;
+  // Offset of the page the next record goes to.
+  uint32_t next_offset;
+};
+
+// Scans the journal and copies the data of the current record, if there is
+// one of the given size, to data. Returns whether it did. Reads flash through
+// XIP only, so it can run before anything else is initialised.
+bool journal_load(struct Journal *journal, void *data, size_t size);
+
+// Appends a record. Erases and programs flash with interrupts disabled, so
+// core 1 must be paused and it must not be called on a latency sensitive path.
+void journal_save(struct Journal *journal, const void *data, size_t size);
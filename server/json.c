@@ -0,0 +1,114 @@
+#include <string.h>
+
+#include "json.h"
+
+static const char *skip_space(const char *c, const char *end) {
+  while (c < end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n'))
+    ++c;
+  return c;
+}
+
+// Skips a string starting at its opening quote. Returns NULL if it is not
+// terminated.
+static const char *skip_string(const char *c, const char *end) {
+  for (++c; c < end; ++c) {
+    if (*c == '\\')
+      ++c;
+    else if (*c == '"')
+      return c + 1;
+  }
+  return NULL;
+}
+
+// Skips a scalar value: a string, a number, true, false or null.
+static const char *skip_value(const char *c, const char *end) {
+  if (c < end && *c == '"')
+    return skip_string(c, end);
+  const char *start = c;
+  while (c < end && (*c == '-' || *c == '+' || *c == '.' || (*c >= '0' && *c <= '9')
+                     || (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z')))
+    ++c;
+  return c > start ? c : NULL;
+}
+
+// Walks the members of a flat object, looking for key if it is not NULL.
+static int find_member(const char *json, size_t length, const char *key, const char **value, const char **value_end) {
+  const char *c = json, *end = json + length;
+  size_t key_length = key ? strlen(key) : 0;
+  int result = JSON_MISSING;
+
+  c = skip_space(c, end);
+  if (c == end || *c++ != '{')
+    return JSON_INVALID;
+  c = skip_space(c, end);
+  if (c < end && *c == '}') {
+    ++c;
+  } else {
+    while (true) {
+      if (c == end || *c != '"')
+        return JSON_INVALID;
+      const char *name = c + 1;
+      c = skip_string(c, end);
+      if (!c)
+        return JSON_INVALID;
+      bool match = key && (size_t)(c - 1 - name) == key_length && !memcmp(name, key, key_length);
+      c = skip_space(c, end);
+      if (c == end || *c++ != ':')
+        return JSON_INVALID;
+      c = skip_space(c, end);
+      const char *start = c;
+      c = skip_value(c, end);
+      if (!c)
+        return JSON_INVALID;
+      if (match) {
+        *value = start;
+        *value_end = c;
+        result = JSON_FOUND;
+      }
+      c = skip_space(c, end);
+      if (c < end && *c == ',') {
+        c = skip_space(c + 1, end);
+        continue;
+      }
+      if (c == end || *c++ != '}')
+        return JSON_INVALID;
+      break;
+    }
+  }
+  return skip_space(c, end) == end ? result : JSON_INVALID;
+}
+
+bool json_is_object(const char *json, size_t length) {
+  return find_member(json, length, NULL, NULL, NULL) != JSON_INVALID;
+}
+
+int json_get_bool(const char *json, size_t length, const char *key, bool *value) {
+  const char *start, *end;
+  int result = find_member(json, length, key, &start, &end);
+  if (result != JSON_FOUND)
+    return result;
+  if (end - start == 4 && !memcmp(start, "true", 4))
+    *value = true;
+  else if (end - start == 5 && !memcmp(start, "false", 5))
+    *value = false;
+  else
+    return JSON_INVALID;
+  return JSON_FOUND;
+}
+
+int json_get_uint(const char *json, size_t length, const char *key, uint32_t max, uint32_t *value) {
+  const char *start, *end;
+  int result = find_member(json, length, key, &start, &end);
+  if (result != JSON_FOUND)
+    return result;
+  uint32_t number = 0;
+  for (const char *c = start; c < end; ++c) {
+    if (*c < '0' || *c > '9')
+      return JSON_INVALID;
+    number = number * 10 + (*c - '0');
+    if (number > max)
+      return JSON_INVALID;
+  }
+  *value = number;
+  return JSON_FOUND;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Just enough JSON for the REST endpoints: reading members of a flat object
+// such as {"on": true, "level": 32768}. Nested values are not looked into.
+
+// Return values of the json_get_* functions.
+#define JSON_FOUND 0
+#define JSON_MISSING 1
+#define JSON_INVALID 2
+
+// Checks that the text is a single flat object.
+bool json_is_object(const char *json, size_t length);
+
+int json_get_bool(const char *json, size_t length, const char *key, bool *value);
+
+// Reads a non-negative integer no greater than max.
+int json_get_uint(const char *json, size_t length, const char *key, uint32_t max, uint32_t *value);
@@ -0,0 +1,376 @@
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+
+#include "crc32.h"
+#include "kv.h"
+
+#define SECTOR_MAGIC 0x4B565331
+#define SECTOR_RETIRED 0
+#define ENTRY_MAGIC 0x4B
+#define ENTRY_ERASED 0xFF
+#define TOMBSTONE 0xFFFF
+#define SLOT_EMPTY 0
+#define SLOT_DELETED 1
+
+_Static_assert(KV_SECTORS >= 2, "the store needs a spare sector for compaction");
+_Static_assert(KV_OFFSET % FLASH_SECTOR_SIZE == 0, "the store must start on a sector");
+_Static_assert((KV_INDEX_SIZE & (KV_INDEX_SIZE - 1)) == 0, "KV_INDEX_SIZE must be a power of two");
+_Static_assert(KV_MAX_VALUE_SIZE < TOMBSTONE, "value lengths must not collide with the tombstone");
+
+struct SectorHeader {
+  uint32_t magic;
+  uint32_t sequence;
+};
+
+// Followed by the key and the value, padded to a multiple of 4 bytes.
+struct EntryHeader {
+  uint8_t magic;
+  uint8_t key_length;
+  uint16_t value_length;
+  // Over the lengths, the key and the value.
+  uint32_t crc;
+};
+
+static const void *flash_at(uint32_t offset) {
+  return (const void *)(XIP_BASE + offset);
+}
+
+static uint32_t sector_start(unsigned sector) {
+  return KV_OFFSET + sector * FLASH_SECTOR_SIZE;
+}
+
+static size_t value_size(uint16_t value_length) {
+  return value_length == TOMBSTONE ? 0 : value_length;
+}
+
+static size_t entry_size(size_t key_length, size_t value_length) {
+  return (sizeof(struct EntryHeader) + key_length + value_length + 3) & ~(size_t)3;
+}
+
+static uint32_t entry_crc(const struct EntryHeader *header, const void *key, const void *value) {
+  uint32_t crc = crc32_update(CRC32_INIT, &header->key_length, sizeof(header->key_length));
+  crc = crc32_update(crc, &header->value_length, sizeof(header->value_length));
+  crc = crc32_update(crc, key, header->key_length);
+  return ~crc32_update(crc, value, value_size(header->value_length));
+}
+
+// Programs bytes at any offset. The pages they fall in are programmed with
+// the rest left erased, which keeps whatever was programmed there before.
+static void program(uint32_t offset, const void *data, size_t length) {
+  static uint8_t page[FLASH_PAGE_SIZE];
+  const uint8_t *bytes = data;
+  while (length > 0) {
+    uint32_t page_offset = offset & ~(uint32_t)(FLASH_PAGE_SIZE - 1);
+    size_t start = offset - page_offset;
+    size_t n = length < FLASH_PAGE_SIZE - start ? length : FLASH_PAGE_SIZE - start;
+    memset(page, 0xFF, sizeof(page));
+    memcpy(&page[start], bytes, n);
+    uint32_t interrupts = save_and_disable_interrupts();
+    flash_range_program(page_offset, page, FLASH_PAGE_SIZE);
+    restore_interrupts(interrupts);
+    offset += n;
+    bytes += n;
+    length -= n;
+  }
+}
+
+static bool sector_erased(unsigned sector) {
+  const uint32_t *words = flash_at(sector_start(sector));
+  for (size_t i = 0; i < FLASH_SECTOR_SIZE / sizeof(uint32_t); ++i) {
+    if (words[i] != 0xFFFFFFFF)
+      return false;
+  }
+  return true;
+}
+
+static void erase(unsigned sector) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  flash_range_erase(sector_start(sector), FLASH_SECTOR_SIZE);
+  restore_interrupts(interrupts);
+}
+
+static uint32_t hash_key(const char *key, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i)
+    hash = (hash ^ (uint8_t)key[i]) * 16777619u;
+  return hash;
+}
+
+static unsigned sector_of(uint32_t offset) {
+  return (offset - KV_OFFSET) / FLASH_SECTOR_SIZE;
+}
+
+static uint32_t sector_sequence(unsigned sector) {
+  return ((const struct SectorHeader *)flash_at(sector_start(sector)))->sequence;
+}
+
+static size_t stored_size(uint32_t offset) {
+  const struct EntryHeader *header = flash_at(offset);
+  return entry_size(header->key_length, value_size(header->value_length));
+}
+
+// Checks an entry that must end by end.
+static bool entry_valid(uint32_t offset, uint32_t end) {
+  const struct EntryHeader *header = flash_at(offset);
+  if (offset + sizeof(*header) > end || header->magic != ENTRY_MAGIC || header->key_length == 0
+      || header->key_length > KV_MAX_KEY_SIZE || value_size(header->value_length) > KV_MAX_VALUE_SIZE
+      || offset + stored_size(offset) > end)
+    return false;
+  const char *key = (const char *)(header + 1);
+  return header->crc == entry_crc(header, key, key + header->key_length);
+}
+
+static bool entry_has_key(uint32_t offset, const char *key, size_t length) {
+  const struct EntryHeader *header = flash_at(offset);
+  return header->key_length == length && !memcmp(flash_at(offset + sizeof(*header)), key, length);
+}
+
+// Returns the slot holding key and sets found, or returns the slot it would
+// go to, -1 if the index is full.
+static int index_find(const struct KvStore *store, const char *key, size_t length, bool *found) {
+  int free_slot = -1;
+  unsigned slot = hash_key(key, length) & (KV_INDEX_SIZE - 1);
+  *found = false;
+  for (size_t i = 0; i < KV_INDEX_SIZE; ++i, slot = (slot + 1) & (KV_INDEX_SIZE - 1)) {
+    uint32_t offset = store->index[slot];
+    if (offset == SLOT_EMPTY)
+      return free_slot >= 0 ? free_slot : (int)slot;
+    if (offset == SLOT_DELETED) {
+      if (free_slot < 0)
+        free_slot = slot;
+    } else if (entry_has_key(offset, key, length)) {
+      *found = true;
+      return slot;
+    }
+  }
+  return free_slot;
+}
+
+// Points the index at the latest entry of a key, or removes it for a
+// tombstone. Returns false if the index is full.
+static bool index_update(struct KvStore *store, const char *key, size_t length, uint32_t offset, bool tombstone) {
+  bool found;
+  int slot = index_find(store, key, length, &found);
+  if (found) {
+    uint32_t previous = store->index[slot];
+    store->live[sector_of(previous)] -= stored_size(previous);
+  } else if (tombstone) {
+    return true;
+  } else if (slot < 0 || store->keys == KV_MAX_KEYS) {
+    return false;
+  }
+  if (tombstone) {
+    store->index[slot] = SLOT_DELETED;
+    --store->keys;
+    return true;
+  }
+  store->keys += !found;
+  store->index[slot] = offset;
+  store->live[sector_of(offset)] += stored_size(offset);
+  return true;
+}
+
+// Replays the entries of a sector into the index. Returns where the log of the
+// sector ends: at the first erased header, or at its end after an entry that
+// fails its CRC, so that nothing is appended after a torn write.
+static uint32_t replay_sector(struct KvStore *store, unsigned sector) {
+  uint32_t offset = sector_start(sector) + sizeof(struct SectorHeader);
+  uint32_t end = sector_start(sector) + FLASH_SECTOR_SIZE;
+  while (offset + sizeof(struct EntryHeader) <= end) {
+    const struct EntryHeader *header = flash_at(offset);
+    if (header->magic == ENTRY_ERASED)
+      return offset;
+    if (!entry_valid(offset, end))
+      return end;
+    index_update(store, (const char *)(header + 1), header->key_length, offset, header->value_length == TOMBSTONE);
+    offset += stored_size(offset);
+  }
+  return end;
+}
+
+void kv_init(struct KvStore *store) {
+  memset(store, 0, sizeof(*store));
+  bool replayed[KV_SECTORS] = {false};
+  // Sectors are replayed oldest first; sequence numbers may wrap.
+  while (true) {
+    int oldest = -1;
+    for (unsigned sector = 0; sector < KV_SECTORS; ++sector) {
+      const struct SectorHeader *header = flash_at(sector_start(sector));
+      if (replayed[sector] || header->magic != SECTOR_MAGIC)
+        continue;
+      if (oldest < 0 || (int32_t)(header->sequence - sector_sequence(oldest)) < 0)
+        oldest = sector;
+    }
+    if (oldest < 0)
+      break;
+    replayed[oldest] = true;
+    if (store->used++ == 0)
+      store->tail = oldest;
+    store->head = oldest;
+    store->sequence = sector_sequence(oldest);
+    store->write_offset = replay_sector(store, oldest);
+  }
+}
+
+// Starts a new head sector after the current one.
+static void open_sector(struct KvStore *store) {
+  unsigned sector = store->used ? (store->head + 1) % KV_SECTORS : store->tail;
+  if (!sector_erased(sector))
+    erase(sector);
+  struct SectorHeader header = {SECTOR_MAGIC, store->sequence + 1};
+  program(sector_start(sector), &header, sizeof(header));
+  if (store->used++ == 0)
+    store->tail = sector;
+  store->head = sector;
+  store->sequence = header.sequence;
+  store->write_offset = sector_start(sector) + sizeof(header);
+}
+
+// Appends an entry and returns its offset, or 0 if it needs a new sector and
+// only the spare one is left, unless the spare may be used. Without a spare,
+// left by a compaction cut short by a power loss, only compaction may append
+// until it has been completed.
+static uint32_t append(struct KvStore *store, const char *key, size_t key_length, const void *value, uint16_t value_length, bool use_spare) {
+  static uint8_t entry[sizeof(struct EntryHeader) + KV_MAX_KEY_SIZE + KV_MAX_VALUE_SIZE];
+  size_t size = entry_size(key_length, value_size(value_length));
+  if (store->used == KV_SECTORS && !use_spare)
+    return 0;
+  if (!store->used || store->write_offset + size > sector_start(store->head) + FLASH_SECTOR_SIZE) {
+    if (store->used >= KV_SECTORS - (use_spare ? 0 : 1))
+      return 0;
+    open_sector(store);
+  }
+
+  struct EntryHeader *header = (struct EntryHeader *)entry;
+  memset(entry, 0, size);
+  header->magic = ENTRY_MAGIC;
+  header->key_length = key_length;
+  header->value_length = value_length;
+  memcpy(&entry[sizeof(*header)], key, key_length);
+  if (value_size(value_length))
+    memcpy(&entry[sizeof(*header) + key_length], value, value_size(value_length));
+  header->crc = entry_crc(header, &entry[sizeof(*header)], &entry[sizeof(*header) + key_length]);
+
+  uint32_t offset = store->write_offset;
+  program(offset, entry, size);
+  store->write_offset += size;
+  return offset;
+}
+
+// Moves the live entries of the oldest sector to the head and erases it.
+static void retire(unsigned sector) {
+  uint32_t retired = SECTOR_RETIRED;
+  program(sector_start(sector), &retired, sizeof(retired));
+  erase(sector);
+}
+
+static void compact(struct KvStore *store) {
+  if (store->tail == store->head)
+    open_sector(store);
+  unsigned sector = store->tail;
+  uint32_t offset = sector_start(sector) + sizeof(struct SectorHeader);
+  uint32_t end = sector_start(sector) + FLASH_SECTOR_SIZE;
+  for (; entry_valid(offset, end); offset += stored_size(offset)) {
+    const struct EntryHeader *header = flash_at(offset);
+    const char *key = (const char *)(header + 1);
+    bool found;
+    int slot = index_find(store, key, header->key_length, &found);
+    // Tombstones are dropped: nothing older than this sector is left for them
+    // to hide.
+    if (found && store->index[slot] == offset) {
+      uint32_t moved = append(store, key, header->key_length, key + header->key_length, header->value_length, true);
+      if (!moved) {
+        // Only a compaction cut short by a power loss leaves no spare. The
+        // head then holds nothing but copies of entries of this sector, so it
+        // is dropped and the compaction starts over.
+        retire(store->head);
+        kv_init(store);
+        return;
+      }
+      store->index[slot] = moved;
+      store->live[sector] -= stored_size(offset);
+      store->live[sector_of(moved)] += stored_size(moved);
+    }
+  }
+
+  retire(sector);
+  store->tail = (sector + 1) % KV_SECTORS;
+  --store->used;
+}
+
+// Appends an entry, compacting first if the spare sector would be needed.
+// Each sector may need compacting, after restarting an interrupted compaction.
+static uint32_t append_compacting(struct KvStore *store, const char *key, size_t key_length, const void *value, uint16_t value_length) {
+  for (unsigned i = 0; i < 2 * KV_SECTORS; ++i) {
+    uint32_t offset = append(store, key, key_length, value, value_length, false);
+    if (offset)
+      return offset;
+    compact(store);
+  }
+  return 0;
+}
+
+int kv_get(const struct KvStore *store, const char *key, void *value, size_t size, size_t *length) {
+  bool found;
+  int slot = index_find(store, key, strlen(key), &found);
+  if (!found)
+    return KV_NOT_FOUND;
+  const struct EntryHeader *header = flash_at(store->index[slot]);
+  if (header->value_length > size)
+    return KV_TOO_LARGE;
+  memcpy(value, (const char *)(header + 1) + header->key_length, header->value_length);
+  *length = header->value_length;
+  return KV_OK;
+}
+
+bool kv_contains(const struct KvStore *store, const char *key) {
+  bool found;
+  index_find(store, key, strlen(key), &found);
+  return found;
+}
+
+int kv_set(struct KvStore *store, const char *key, const void *value, size_t length) {
+  size_t key_length = strlen(key);
+  if (key_length == 0 || key_length > KV_MAX_KEY_SIZE || length > KV_MAX_VALUE_SIZE)
+    return KV_TOO_LARGE;
+  bool found;
+  int slot = index_find(store, key, key_length, &found);
+  if (found) {
+    const struct EntryHeader *header = flash_at(store->index[slot]);
+    if (header->value_length == length && !memcmp((const char *)(header + 1) + key_length, value, length))
+      return KV_OK;
+  } else if (slot < 0 || store->keys == KV_MAX_KEYS) {
+    return KV_FULL;
+  }
+  uint32_t offset = append_compacting(store, key, key_length, value, length);
+  if (!offset)
+    return KV_FULL;
+  index_update(store, key, key_length, offset, false);
+  return KV_OK;
+}
+
+int kv_delete(struct KvStore *store, const char *key) {
+  size_t key_length = strlen(key);
+  if (!kv_contains(store, key))
+    return KV_NOT_FOUND;
+  if (!append_compacting(store, key, key_length, NULL, TOMBSTONE))
+    return KV_FULL;
+  index_update(store, key, key_length, 0, true);
+  return KV_OK;
+}
+
+bool kv_maintenance_due(const struct KvStore *store) {
+  // Only worth it if the head sector takes the live entries without the
+  // spare, or nothing would be freed.
+  uint32_t head_free = sector_start(store->head) + FLASH_SECTOR_SIZE - store->write_offset;
+  return store->used == KV_SECTORS
+         || (store->used == KV_SECTORS - 1 && store->tail != store->head && store->live[store->tail] <= head_free);
+}
+
+void kv_maintain(struct KvStore *store) {
+  if (kv_maintenance_due(store))
+    compact(store);
+}
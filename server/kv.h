@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hardware/flash.h"
+
+#include "journal.h"
+
+// Key-value store for settings in flash, kept as an append-only log over a
+// ring of sectors. Setting a key appends an entry with a CRC; the latest entry
+// of a key wins and deleting appends a tombstone. An index built in RAM at
+// boot maps each key to its latest entry, so lookups do not scan the log.
+//
+// Sectors are used in turn, which spreads the erases over all of them. Once
+// only the spare sector is left, the oldest sector is compacted: its live
+// entries are appended to the newest one and it is erased. kv_maintain does
+// this from the main loop before a write has to wait for it.
+//
+// A write cut short by a power loss leaves an entry that fails its CRC and
+// ends the log of its sector; the entry it was replacing stays current. A
+// sector is marked retired before it is erased, so that one whose erase was
+// cut short is not mistaken for part of the log.
+//
+// The store sits below the state journal at the end of flash.
+
+#ifndef KV_SECTORS
+#define KV_SECTORS 4
+#endif
+#define KV_OFFSET (JOURNAL_OFFSET - KV_SECTORS * FLASH_SECTOR_SIZE)
+#define KV_MAX_KEY_SIZE 32
+#define KV_MAX_VALUE_SIZE 512
+#define KV_MAX_KEYS 32
+#define KV_INDEX_SIZE (2 * KV_MAX_KEYS)
+
+// Return values of the functions below.
+#define KV_OK 0
+#define KV_NOT_FOUND 1
+#define KV_TOO_LARGE 2
+#define KV_FULL 3
+
+struct KvStore {
+  // The log runs from the tail to the head sector in ring order.
+  unsigned tail;
+  unsigned head;
+  unsigned used;
+  uint32_t sequence;
+  // Where the next entry goes in the head sector.
+  uint32_t write_offset;
+  // Open addressing table of flash offsets of the latest entry of each key.
+  uint32_t index[KV_INDEX_SIZE];
+  unsigned keys;
+  // Bytes of each sector taken by latest entries, which compaction keeps.
+  uint32_t live[KV_SECTORS];
+};
+
+// Replays the log into the index. Reads flash through XIP only, so it can run
+// before anything else is initialised.
+void kv_init(struct KvStore *store);
+
+// Copies the value of key to value, which holds size bytes, and sets length.
+// Returns KV_NOT_FOUND, KV_TOO_LARGE if it does not fit, or KV_OK.
+int kv_get(const struct KvStore *store, const char *key, void *value, size_t size, size_t *length);
+
+// Returns whether key has a value.
+bool kv_contains(const struct KvStore *store, const char *key);
+
+// The functions below program and erase flash with interrupts disabled, so
+// core 1 must be paused around them.
+
+// Sets key to length bytes of value. Writing the value a key already has does
+// not touch flash. Returns KV_TOO_LARGE for an oversized key or value,
+// KV_FULL if there is no room for it even after compaction, or KV_OK.
+int kv_set(struct KvStore *store, const char *key, const void *value, size_t length);
+
+// Removes key. Returns KV_NOT_FOUND, KV_FULL or KV_OK.
+int kv_delete(struct KvStore *store, const char *key);
+
+// Returns whether kv_maintain has work to do.
+bool kv_maintenance_due(const struct KvStore *store);
+
+// Compacts the oldest sector once only the spare sector is free, if its live
+// entries fit in the newest one, so that writes seldom wait for an erase.
+void kv_maintain(struct KvStore *store);
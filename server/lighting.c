@@ -0,0 +1,377 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+
+#include "gamma_table.h"
+#include "lighting.h"
+#include "strip.h"
+
+#define COMMAND_RING_SIZE 32
+#define FADE_STEP_US 1000
+#define EFFECT_STEP_US 2000
+#define STROBE_PULSE_US 20000
+
+#if STRIP_PIXELS > STRIP_MAX_PIXELS
+#error "STRIP_PIXELS exceeds STRIP_MAX_PIXELS"
+#endif
+
+#if STRIP_RGBW
+#define STRIP_FORMAT STRIP_GRBW
+#define STRIP_WHITE ((struct Pixel){0, 0, 0, 255})
+#else
+#define STRIP_FORMAT STRIP_GRB
+#define STRIP_WHITE ((struct Pixel){255, 255, 255, 0})
+#endif
+
+enum LightingCommandType {
+  LIGHTING_LEVEL,
+  LIGHTING_EFFECT,
+};
+#define LIGHTING_COMMAND_TYPES 2
+
+struct LightingCommand {
+  enum LightingCommandType type;
+  uint32_t value;
+  uint32_t duration_ms;
+  // time_us_32 when core 0 issued it.
+  uint32_t issued_us;
+};
+
+// Single-producer/single-consumer ring from core 0 to core 1. Core 0 pushes
+// with interrupts disabled so that its thread and interrupt context act as
+// one producer. The SIO FIFO is left to multicore_lockout.
+static struct {
+  struct LightingCommand commands[COMMAND_RING_SIZE];
+  atomic_uint head;
+  atomic_uint tail;
+} ring;
+
+// Commands that found the ring full. Core 0 does not wait for room, as it may
+// be in an interrupt handler; it keeps only the latest command of each type,
+// which overrides the ones before it. Until core 1 has taken them all, later
+// commands are kept here too, and core 1 takes them only once the ring is
+// empty, so the commands are applied in order. Pushes are made under the
+// hardware spin lock, which core 1 holds only to take a command.
+static struct {
+  spin_lock_t *lock;
+  volatile uint32_t pending;
+  struct LightingCommand commands[LIGHTING_COMMAND_TYPES];
+} overflow;
+
+// Latest pixel frame from core 0. It is too large for the command ring, so it
+// is handed over under a hardware spin lock, which core 1 holds only for the
+// copy.
+static struct {
+  spin_lock_t *lock;
+  bool pending;
+  struct Pixel pixels[STRIP_PIXELS > 0 ? STRIP_PIXELS : 1];
+} pixel_frame;
+
+// Core 1 state. Fades and effects are advanced from alarm interrupts on
+// core 1, so the main loop of core 1 changes them with interrupts disabled.
+// The fade produces the base level, which the effect then modulates into the
+// output level.
+static struct {
+  alarm_pool_t *alarm_pool;
+  repeating_timer_t fade_timer;
+  bool fading;
+  uint16_t base_level;
+  uint16_t level;
+  uint16_t fade_from;
+  uint16_t fade_to;
+  uint64_t fade_start_us;
+  uint64_t fade_duration_us;
+  repeating_timer_t effect_timer;
+  bool effect_running;
+  struct LightingEffect effect;
+  uint64_t effect_start_us;
+  // The strip shows these pixels scaled by the LED level.
+  struct Pixel pixels[STRIP_PIXELS > 0 ? STRIP_PIXELS : 1];
+  volatile bool strip_dirty;
+  struct Histogram output_latency;
+} engine;
+
+static void send(enum LightingCommandType type, uint32_t value, uint32_t duration_ms) {
+  struct LightingCommand command = {type, value, duration_ms, time_us_32()};
+  uint32_t interrupts = spin_lock_blocking(overflow.lock);
+  unsigned head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+  if (!overflow.pending && head - atomic_load_explicit(&ring.tail, memory_order_acquire) < COMMAND_RING_SIZE) {
+    ring.commands[head % COMMAND_RING_SIZE] = command;
+    atomic_store_explicit(&ring.head, head + 1, memory_order_release);
+  } else {
+    overflow.commands[type] = command;
+    overflow.pending |= 1u << type;
+  }
+  spin_unlock(overflow.lock, interrupts);
+  // Wake core 1 if it is waiting for work.
+  __sev();
+}
+
+static void __not_in_flash_func(receive_pixels)(void) {
+  if (!pixel_frame.pending)
+    return;
+  uint32_t interrupts = spin_lock_blocking(pixel_frame.lock);
+  memcpy(engine.pixels, pixel_frame.pixels, sizeof(engine.pixels));
+  pixel_frame.pending = false;
+  spin_unlock(pixel_frame.lock, interrupts);
+  engine.strip_dirty = true;
+}
+
+static bool __not_in_flash_func(receive_overflow)(struct LightingCommand *command) {
+  if (!overflow.pending)
+    return false;
+  uint32_t interrupts = spin_lock_blocking(overflow.lock);
+  // Only core 1 clears the bits, so one is still set.
+  unsigned type = __builtin_ctz(overflow.pending);
+  *command = overflow.commands[type];
+  overflow.pending &= ~(1u << type);
+  spin_unlock(overflow.lock, interrupts);
+  return true;
+}
+
+static bool __not_in_flash_func(receive)(struct LightingCommand *command) {
+  unsigned tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&ring.head, memory_order_acquire))
+    return receive_overflow(command);
+  *command = ring.commands[tail % COMMAND_RING_SIZE];
+  atomic_store_explicit(&ring.tail, tail + 1, memory_order_release);
+  return true;
+}
+
+// Maps a perceptual level to a PWM level, interpolating between the entries
+// of the generated gamma table.
+static uint16_t __not_in_flash_func(gamma_correct)(uint16_t level) {
+  uint32_t i = level >> 8, fraction = level & 0xFF;
+  uint32_t low = gamma_table[i], high = gamma_table[i + 1];
+  return low + (((high - low) * fraction) >> 8);
+}
+
+// Position within the effect period, phase shifted.
+static uint32_t __not_in_flash_func(effect_position)(uint64_t now) {
+  uint32_t period_us = engine.effect.period_ms * 1000u;
+  uint64_t shift = (uint64_t)engine.effect.phase * period_us / 256;
+  return (now - engine.effect_start_us + shift) % period_us;
+}
+
+// Duty cycle in microseconds; a duty of zero means half the period.
+static uint32_t __not_in_flash_func(effect_on_time)(void) {
+  uint32_t period_us = engine.effect.period_ms * 1000u;
+  return engine.effect.duty ? (uint64_t)engine.effect.duty * period_us / 256 : period_us / 2;
+}
+
+static uint16_t __not_in_flash_func(effect_level)(uint16_t base, uint64_t now) {
+  if (!engine.effect_running)
+    return base;
+  uint32_t period_us = engine.effect.period_ms * 1000u;
+  uint32_t t = effect_position(now);
+  switch (engine.effect.mode) {
+  case LIGHTING_BLINK:
+    return t < effect_on_time() ? base : 0;
+  case LIGHTING_STROBE:
+    return t < (STROBE_PULSE_US < period_us / 2 ? STROBE_PULSE_US : period_us / 2) ? base : 0;
+  case LIGHTING_BREATHE: {
+    // Triangle wave on the perceptual scale, which gamma makes look smooth.
+    uint32_t x = (uint64_t)t * 2 * LED_MAX_LEVEL / period_us;
+    uint32_t wave = x <= LED_MAX_LEVEL ? x : 2 * LED_MAX_LEVEL - x;
+    return (uint32_t)base * wave / LED_MAX_LEVEL;
+  }
+  default:
+    // The chase runs on the strip only.
+    return base;
+  }
+}
+
+static void __not_in_flash_func(render_led)(void) {
+  uint16_t level = effect_level(engine.base_level, time_us_64());
+  if (level != engine.level)
+    engine.strip_dirty = true;
+  engine.level = level;
+  pwm_set_gpio_level(LED_GPIO, gamma_correct(level));
+}
+
+static void __not_in_flash_func(output_level)(uint16_t level) {
+  engine.base_level = level;
+  render_led();
+}
+
+// Blanks everything but a segment of the strip that travels along it once
+// per period.
+static void __not_in_flash_func(render_chase)(uint32_t *words) {
+  uint32_t count = strip_pixel_count();
+  uint32_t period_us = engine.effect.period_ms * 1000u;
+  uint32_t head = (uint64_t)effect_position(time_us_64()) * count / period_us;
+  uint32_t width = (uint64_t)effect_on_time() * count / period_us;
+  if (width == 0)
+    width = 1;
+  for (uint32_t i = 0; i < count; ++i) {
+    if ((head + count - i) % count >= width)
+      words[i] = 0;
+  }
+}
+
+// Encodes the next strip frame if it changed and a buffer is free. Otherwise
+// this is retried when the latch alarm of the current frame wakes the core,
+// so intermediate fade steps are skipped rather than queued.
+static void __not_in_flash_func(render_strip)(void) {
+  if (STRIP_PIXELS == 0 || !engine.strip_dirty)
+    return;
+  uint32_t *words = strip_back_buffer();
+  if (!words)
+    return;
+  engine.strip_dirty = false;
+  strip_encode(words, engine.pixels, STRIP_PIXELS, STRIP_FORMAT, engine.level >> 8);
+  if (engine.effect_running && engine.effect.mode == LIGHTING_CHASE)
+    render_chase(words);
+  strip_show();
+}
+
+// Fades are time based, so a late alarm does not slow the fade down.
+static bool __not_in_flash_func(fade_step)(repeating_timer_t *timer) {
+  uint64_t elapsed = time_us_64() - engine.fade_start_us;
+  if (elapsed >= engine.fade_duration_us) {
+    output_level(engine.fade_to);
+    engine.fading = false;
+    return false;
+  }
+  int32_t delta = (int32_t)engine.fade_to - engine.fade_from;
+  output_level(engine.fade_from + (int32_t)((int64_t)delta * (int64_t)elapsed / (int64_t)engine.fade_duration_us));
+  return true;
+}
+
+static void __not_in_flash_func(start_fade)(uint16_t level, uint32_t duration_ms) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  if (engine.fading) {
+    cancel_repeating_timer(&engine.fade_timer);
+    engine.fading = false;
+  }
+  if (duration_ms == 0 || level == engine.base_level) {
+    output_level(level);
+  } else {
+    engine.fade_from = engine.base_level;
+    engine.fade_to = level;
+    engine.fade_start_us = time_us_64();
+    engine.fade_duration_us = duration_ms * 1000ull;
+    engine.fading = alarm_pool_add_repeating_timer_us(engine.alarm_pool, -FADE_STEP_US, fade_step, NULL, &engine.fade_timer);
+    if (!engine.fading)
+      output_level(level);
+  }
+  restore_interrupts(interrupts);
+}
+
+static bool __not_in_flash_func(effect_step)(repeating_timer_t *timer) {
+  render_led();
+  if (engine.effect.mode == LIGHTING_CHASE)
+    engine.strip_dirty = true;
+  return true;
+}
+
+static void __not_in_flash_func(start_effect)(uint32_t packed, uint32_t period_ms) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  if (engine.effect_running) {
+    cancel_repeating_timer(&engine.effect_timer);
+    engine.effect_running = false;
+  }
+  engine.effect = (struct LightingEffect){
+    .mode = packed & 0xFF,
+    .duty = packed >> 8,
+    .phase = packed >> 16,
+    .period_ms = period_ms,
+  };
+  engine.effect_start_us = time_us_64();
+  if (engine.effect.mode != LIGHTING_STEADY && engine.effect.period_ms)
+    engine.effect_running = alarm_pool_add_repeating_timer_us(engine.alarm_pool, -EFFECT_STEP_US, effect_step, NULL, &engine.effect_timer);
+  render_led();
+  engine.strip_dirty = true;
+  restore_interrupts(interrupts);
+}
+
+static void __not_in_flash_func(apply)(const struct LightingCommand *command) {
+  switch (command->type) {
+  case LIGHTING_LEVEL:
+    start_fade(command->value, command->duration_ms);
+    break;
+  case LIGHTING_EFFECT:
+    start_effect(command->value, command->duration_ms);
+    break;
+  }
+  histogram_record(&engine.output_latency, time_us_32() - command->issued_us);
+}
+
+static void __not_in_flash_func(core1_main)(void) {
+  multicore_lockout_victim_init();
+  // An alarm pool created here fires its interrupts on core 1.
+  engine.alarm_pool = alarm_pool_create_with_unused_hardware_alarm(4);
+  if (STRIP_PIXELS > 0) {
+    // The DMA interrupt is enabled on this core.
+    for (size_t i = 0; i < STRIP_PIXELS; ++i)
+      engine.pixels[i] = STRIP_WHITE;
+    strip_init(STRIP_GPIO, STRIP_PIXELS, STRIP_FORMAT, engine.alarm_pool);
+    engine.strip_dirty = true;
+  }
+
+  struct LightingCommand command;
+  while (true) {
+    while (receive(&command))
+      apply(&command);
+    receive_pixels();
+    render_strip();
+    __wfe();
+  }
+}
+
+void lighting_init(void) {
+  gpio_set_function(LED_GPIO, GPIO_FUNC_PWM);
+  uint slice = pwm_gpio_to_slice_num(LED_GPIO);
+  pwm_config config = pwm_get_default_config();
+  pwm_config_set_wrap(&config, LED_MAX_LEVEL);
+  pwm_init(slice, &config, true);
+  pwm_set_gpio_level(LED_GPIO, 0);
+  pixel_frame.lock = spin_lock_instance(spin_lock_claim_unused(true));
+  overflow.lock = spin_lock_instance(spin_lock_claim_unused(true));
+  multicore_launch_core1(core1_main);
+}
+
+void lighting_set_level(uint16_t level, uint32_t transition_ms) {
+  send(LIGHTING_LEVEL, level, transition_ms);
+}
+
+void lighting_set_effect(const struct LightingEffect *effect) {
+  send(LIGHTING_EFFECT, effect->mode | effect->duty << 8 | effect->phase << 16, effect->period_ms);
+}
+
+void lighting_set_pixels(const uint8_t *data, size_t length) {
+  size_t stride = STRIP_RGBW ? 4 : 3;
+  size_t count = length / stride;
+  if (count > STRIP_PIXELS)
+    count = STRIP_PIXELS;
+  if (count == 0)
+    return;
+  uint32_t interrupts = spin_lock_blocking(pixel_frame.lock);
+  // Core 1 only writes its pixels while holding the lock, so they can be read
+  // here to carry over the pixels this frame does not cover.
+  if (!pixel_frame.pending)
+    memcpy(pixel_frame.pixels, engine.pixels, sizeof(pixel_frame.pixels));
+  for (size_t i = 0; i < count; ++i, data += stride)
+    pixel_frame.pixels[i] = (struct Pixel){data[0], data[1], data[2], STRIP_RGBW ? data[3] : 0};
+  pixel_frame.pending = true;
+  spin_unlock(pixel_frame.lock, interrupts);
+  __sev();
+}
+
+const struct Histogram *lighting_output_latency(void) {
+  return &engine.output_latency;
+}
+
+void lighting_pause(void) {
+  multicore_lockout_start_blocking();
+}
+
+void lighting_resume(void) {
+  multicore_lockout_end_blocking();
+}
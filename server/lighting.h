@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+// The lighting engine owns the LED outputs and runs on core 1, so rendering
+// is not delayed by the network stack on core 0 and vice versa. Core 0 drives
+// it through a command ring; the functions below may be called from core 0
+// thread or interrupt context but not from core 1.
+
+#define LED_GPIO 16
+#define LED_MAX_LEVEL 65535
+
+// Optional addressable strip, configured from CMake. Its pixels are shown
+// scaled by the level of the LED.
+#ifndef STRIP_PIXELS
+#define STRIP_PIXELS 0
+#endif
+#ifndef STRIP_GPIO
+#define STRIP_GPIO 22
+#endif
+#ifndef STRIP_RGBW
+#define STRIP_RGBW 0
+#endif
+
+// Initialises the outputs and launches the engine on core 1.
+void lighting_init(void);
+
+// Fades the LED from its current level to a perceptual brightness level over
+// transition_ms, which may be zero for an immediate change. The fade is
+// rendered on core 1 from a hardware alarm, gamma corrected.
+void lighting_set_level(uint16_t level, uint32_t transition_ms);
+
+enum LightingMode {
+  LIGHTING_STEADY,
+  LIGHTING_BLINK,
+  LIGHTING_BREATHE,
+  LIGHTING_STROBE,
+  LIGHTING_CHASE,
+  LIGHTING_MODE_COUNT,
+};
+
+// An effect modulates the level set with lighting_set_level, timed on core 1.
+// duty and phase are fractions of the period in 1/256ths; a duty of zero
+// means half the period. A strobe flashes briefly once per period and a
+// chase moves a segment of duty length along the strip.
+struct LightingEffect {
+  uint8_t mode;
+  uint8_t duty;
+  uint8_t phase;
+  uint16_t period_ms;
+};
+
+void lighting_set_effect(const struct LightingEffect *effect);
+
+// Sets the strip pixels from a stream of R, G, B (and W for RGBW strips)
+// values, starting at the first pixel. Pixels past the end of data keep their
+// colour. Only the latest frame is kept if core 1 has not picked up the
+// previous one yet.
+void lighting_set_pixels(const uint8_t *data, size_t length);
+
+// Time from a level or effect being set on core 0 to core 1 writing the new
+// output. Recorded on core 1, so a reader on core 0 may see it mid-update.
+const struct Histogram *lighting_output_latency(void);
+
+// Parks core 1 in RAM so that core 0 can erase or program flash, and releases
+// it again.
+void lighting_pause(void);
+void lighting_resume(void);
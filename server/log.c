@@ -0,0 +1,137 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "hardware/sync.h"
+#include "pico/stdio.h"
+#include "pico/stdlib.h"
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#include "tusb.h"
+#endif
+
+#include "log.h"
+
+// Level and argument count, timestamp and format address.
+#define HEADER_WORDS 3
+// Time log_flush may spend writing.
+#define FLUSH_BUDGET_US 250
+// Output that has not been ready for this long is given up on: the records
+// waiting are dropped, so that a host that stops reading costs neither time
+// nor the ring.
+#define STALL_TIMEOUT_US 100000
+#define LINE_SIZE (8 + 9 * (HEADER_WORDS + LOG_MAX_ARGS))
+
+_Static_assert((LOG_RING_WORDS & (LOG_RING_WORDS - 1)) == 0, "LOG_RING_WORDS must be a power of two");
+
+// Written from thread and interrupt context on core 0, with interrupts
+// disabled so that both act as one producer, and read by log_flush.
+static struct {
+  uint32_t words[LOG_RING_WORDS];
+  atomic_uint head;
+  atomic_uint tail;
+  uint32_t dropped;
+  uint32_t reported_dropped;
+  // Set while the output has no room, from the time it was first found so.
+  bool stalled;
+  uint32_t stalled_us;
+} ring;
+
+void log_write(unsigned level, unsigned count, const char *format, ...) {
+  uint32_t now = time_us_32();
+  uint32_t interrupts = save_and_disable_interrupts();
+  unsigned head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+  if (LOG_RING_WORDS - (head - tail) < HEADER_WORDS + count) {
+    ++ring.dropped;
+    restore_interrupts(interrupts);
+    return;
+  }
+  ring.words[head++ % LOG_RING_WORDS] = level | count << 8;
+  ring.words[head++ % LOG_RING_WORDS] = now;
+  ring.words[head++ % LOG_RING_WORDS] = (uintptr_t)format;
+  va_list args;
+  va_start(args, format);
+  // Every argument is passed in one 32-bit word on the Cortex-M0+.
+  for (unsigned i = 0; i < count; ++i)
+    ring.words[head++ % LOG_RING_WORDS] = va_arg(args, uint32_t);
+  va_end(args);
+  atomic_store_explicit(&ring.head, head, memory_order_release);
+  restore_interrupts(interrupts);
+}
+
+static char *put_hex(char *c, uint32_t value, unsigned digits) {
+  static const char hex[] = "0123456789abcdef";
+  *c++ = ' ';
+  while (digits--)
+    *c++ = hex[value >> (4 * digits) & 0xF];
+  return c;
+}
+
+// Returns whether length bytes can be written without waiting. Only USB CDC
+// output can wait, for the host to read; while no host is connected the SDK
+// discards it.
+static bool output_ready(size_t length) {
+#if LIB_PICO_STDIO_USB
+  return !stdio_usb_connected() || tud_cdc_write_available() >= length;
+#else
+  return true;
+#endif
+}
+
+// Drops the records from tail to head, counting them.
+static void drop_records(unsigned tail, unsigned head) {
+  uint32_t records = 0;
+  for (; tail != head; ++records)
+    tail += HEADER_WORDS + (ring.words[tail % LOG_RING_WORDS] >> 8);
+  atomic_store_explicit(&ring.tail, tail, memory_order_release);
+  uint32_t interrupts = save_and_disable_interrupts();
+  ring.dropped += records;
+  restore_interrupts(interrupts);
+}
+
+void log_flush(void) {
+  uint32_t start = time_us_32();
+  unsigned tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&ring.head, memory_order_acquire);
+  char line[LINE_SIZE];
+  while (tail != head && time_us_32() - start < FLUSH_BUDGET_US) {
+    uint32_t header = ring.words[tail % LOG_RING_WORDS];
+    unsigned words = HEADER_WORDS + (header >> 8);
+    // "@@ <level> <time us> <format> <arguments>..."
+    char *c = line;
+    *c++ = '@';
+    *c++ = '@';
+    c = put_hex(c, header & 0xFF, 1);
+    for (unsigned i = 1; i < words; ++i)
+      c = put_hex(c, ring.words[(tail + i) % LOG_RING_WORDS], 8);
+    // With the "\r\n" the line is written with.
+    if (!output_ready(c - line + 2)) {
+      if (!ring.stalled) {
+        ring.stalled = true;
+        ring.stalled_us = start;
+      } else if (start - ring.stalled_us >= STALL_TIMEOUT_US) {
+        drop_records(tail, head);
+      }
+      break;
+    }
+    ring.stalled = false;
+    tail += words;
+    atomic_store_explicit(&ring.tail, tail, memory_order_release);
+    stdio_put_string(line, c - line, true, true);
+  }
+  uint32_t dropped = ring.dropped;
+  if (dropped != ring.reported_dropped && output_ready(64)) {
+    printf("Log records dropped: %lu.\n", (unsigned long)(dropped - ring.reported_dropped));
+    ring.reported_dropped = dropped;
+  }
+}
+
+bool log_pending(void) {
+  return !ring.stalled
+         && atomic_load_explicit(&ring.head, memory_order_acquire) != atomic_load_explicit(&ring.tail, memory_order_relaxed);
+}
+
+uint32_t log_dropped(void) {
+  return ring.dropped;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Deferred, tokenized logging for the hot path. A log call does not format
+// anything: it stores the level, a timestamp, the address of its format string
+// and its arguments as 32-bit words in a RAM ring, and never blocks. log_flush
+// prints the records from the main loop as hex lines starting with "@@", which
+// tools/log_decode.py turns back into text with the format strings in the ELF.
+// Other output passes through the decoder unchanged. When the ring is full
+// records are dropped and counted, as are records that could not be written
+// because the host stopped reading.
+//
+// Arguments must be at most 32 bits wide: integers, characters and pointers.
+// A %s argument must point to a string in flash, such as a literal, as only
+// its address is kept. 64-bit integers and floating point are not supported.
+// Formats have no trailing newline.
+//
+// Calls below LOG_LEVEL compile to nothing, arguments included.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Must be a power of two.
+#define LOG_RING_WORDS 1024
+#define LOG_MAX_ARGS 8
+
+// The number of arguments after the format, up to LOG_MAX_ARGS.
+#define LOG_ARG_COUNT(...) LOG_ARG_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, too_many_log_arguments)
+#define LOG_ARG_COUNT_(format, _1, _2, _3, _4, _5, _6, _7, _8, count, ...) count
+
+#define LOG_WRITE(level, ...) log_write(level, LOG_ARG_COUNT(__VA_ARGS__), __VA_ARGS__)
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_WRITE(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+// Use the macros above. The format attribute has the compiler check the
+// arguments against the format as for printf.
+void log_write(unsigned level, unsigned count, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+// Prints the records logged since the last call, for a bounded time and only
+// as much as the output can take without waiting, so that a slow host does
+// not hold up the main loop. Call from the main loop.
+void log_flush(void);
+
+// Returns whether records are waiting for log_flush and the output has taken
+// the last of them, so that flushing again makes progress.
+bool log_pending(void);
+
+// Records dropped because the ring was full or the output stalled.
+uint32_t log_dropped(void);
@@ -11,289 +11,176 @@
 #include "pico/error.h"
 #include "pico/printf.h"
 #include "pico/cyw43_arch.h"
+#include "pico/rand.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
 
 #include "lwip/tcp.h"
 #include "lwip/pbuf.h"
 #include "lwip/tcpbase.h"
-
-#include <mbedtls/sha1.h>
-#include <mbedtls/base64.h>
-
-#define SHA1_SIZE 20
-
-#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
-#define WS_FIN (1 << 7)
-#define WS_OPCODE 0x0F
-#define WS_MASK (1 << 7)
-#define WS_PAYLOAD_LEN 0x7F
-#define WS_OP_CONTINUATION 0x00
-#define WS_OP_TEXT 0x01
-#define WS_OP_BINARY 0x02
-#define WS_OP_CLOSE 0x08
-#define WS_OP_PING 0x09
-#define WS_OP_PONG 0x0A
+#include "lwip/udp.h"
+#include "lwip/igmp.h"
+
+#include "boot_timeline.h"
+#include "command.h"
+#include "connection.h"
+#include "dmx.h"
+#include "event.h"
+#include "journal.h"
+#include "kv.h"
+#include "lighting.h"
+#include "log.h"
+#include "metrics.h"
+#include "server.h"
+#include "state_log.h"
 
 #define BUTTON_GPIO 15
-#define LED_GPIO 16
-#define REQUEST_BUF_SIZE 512
-#define BASE64_ENCODED_SIZE 29
 #define PORT 80
+#define WAKEUP_REPORT_MS 60000
+// The button interrupt stays disabled after a press until the pin has read
+// low for DEBOUNCE_MS, sampled every BUTTON_POLL_MS.
+#define DEBOUNCE_MS 30
+#define BUTTON_POLL_MS 5
+// The published state is saved to flash once it has held for this long, so
+// that a burst of changes, a level streamed over DMX included, costs one write.
+#define STATE_SAVE_DELAY_MS 5000
+// Time from reset to listening for clients above which a warning is printed,
+// 0 for none.
+#ifndef BOOT_READY_BUDGET_MS
+#define BOOT_READY_BUDGET_MS 0
+#endif
+// DMX universes and the first slot (from 1) of the LED: a 16-bit level in two
+// slots, followed by R, G, B (and W) slots for each strip pixel.
+#ifndef E131_UNIVERSE
+#define E131_UNIVERSE 1
+#endif
+#ifndef ARTNET_UNIVERSE
+#define ARTNET_UNIVERSE 0
+#endif
+#ifndef DMX_ADDRESS
+#define DMX_ADDRESS 1
+#endif
+#define DMX_LEVEL_SLOTS 2
+#if DMX_ADDRESS < 1 || DMX_ADDRESS - 1 + DMX_LEVEL_SLOTS > DMX_MAX_SLOTS
+#error "DMX_ADDRESS out of range"
+#endif
 #define SSID_SIZE 32
 #define PASSWORD_SIZE 64
-#define HTTP_RESPONSE_FORMAT "HTTP/1.1 %s\r\nServer: smart-led-server\r\nContent-Length: %zu\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n%s"
-
+#define WIFI_KEY "wifi"
+#define WIFI_LINK_KEY "wifi.link"
+#define WIFI_CONNECT_TIMEOUT_MS 30000
+// Joining a known access point on its channel takes well under a second, so
+// a directed join that takes longer gives way to a scan.
+#define WIFI_DIRECTED_TIMEOUT_MS 5000
+
+// Page format of the credentials saved by earlier firmware, which are moved
+// to the settings store.
 struct WiFiCredentials {
   char ssid[SSID_SIZE];
   char password[PASSWORD_SIZE];
   char padding[160];
 };
 
-enum ConnectionState {
-  LISTENING,
-  HANDSHAKE,
-  ONLINE,
+// Where the last connection went: the access point and channel to join again
+// without a scan, and the address DHCP gave, to tell whether it was reused.
+struct WiFiLink {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t address;
 };
-static enum ConnectionState connection_state = LISTENING;
-static struct tcp_pcb *client_pcb = NULL;
-static unsigned char ws_frame[3] = {WS_FIN | WS_OP_BINARY, 1, 0};
-static bool *led_state = (bool *)&ws_frame[2];
-
-static void send_http_error(const char *status, const char *body) {
-  static unsigned char response[256];
-  if (connection_state != LISTENING) {
-    int response_length = sprintf(response, HTTP_RESPONSE_FORMAT, status, strlen(body), body);
-    tcp_write(client_pcb, response, response_length, 0);
-    tcp_output(client_pcb);
-  }
-}
 
-static void send_led_state(void) {
-  if (connection_state == ONLINE) {
-    printf("Sending LED state (%s) to client.\n", *led_state ? "on" : "off");
-    tcp_write(client_pcb, ws_frame, 3, 0);
-    tcp_output(client_pcb);
-  }  
+static struct KvStore settings;
+// Flash copy of the state, restored at boot.
+static struct {
+  struct Journal journal;
+  uint32_t version;
+  bool pending;
+  uint32_t pending_version;
+  absolute_time_t due;
+} saved_state;
+static struct EventRing event_ring;
+
+static struct {
+  struct DmxSequence e131_sequence;
+  struct DmxSequence artnet_sequence;
+  uint32_t frames;
+  uint32_t dropped;
+} dmx;
+static uint32_t button_presses;
+
+void server_add_platform_metrics(struct Metrics *metrics) {
+  metrics_add(metrics, "smart_led_button_presses_total", "counter", button_presses);
+  metrics_add(metrics, "smart_led_events_dropped_total", "counter", atomic_load_explicit(&event_ring.dropped, memory_order_relaxed));
+  metrics_add(metrics, "smart_led_log_dropped_total", "counter", log_dropped());
+  metrics_add(metrics, "smart_led_dmx_frames_total", "counter", dmx.frames);
+  metrics_add(metrics, "smart_led_dmx_dropped_total", "counter", dmx.dropped);
+  metrics_add_lwip(metrics);
 }
 
-static void handle_handshake(struct pbuf *p) {
-  static unsigned char request_buf[REQUEST_BUF_SIZE];
-  static size_t request_buf_length = 0;
-
-  unsigned char *buf_end = &request_buf[request_buf_length];
-  size_t space_left = REQUEST_BUF_SIZE - request_buf_length;
-  u16_t n = pbuf_copy_partial(p, buf_end, space_left, 0);
-  request_buf_length += n;
-
-  const unsigned char *header_end = memmem(buf_end, n, "\r\n\r\n", 4);
-  if (!header_end)
+static void handle_dmx_frame(const struct DmxFrame *frame) {
+  bool e131 = frame->protocol == DMX_E131;
+  if (frame->universe != (e131 ? E131_UNIVERSE : ARTNET_UNIVERSE))
     return;
-
-  if (request_buf_length < 16 || memcmp(request_buf, "GET / HTTP/1.1\r\n", 16)) {
-    printf("Invalid handshake request.\n");
-    send_http_error("400 Bad Request", "Invalid status line.");
-    request_buf_length = 0;
+  // Late and out-of-order frames are dropped rather than applied: the next
+  // frame carries the full state anyway.
+  if (!dmx_sequence_accept(e131 ? &dmx.e131_sequence : &dmx.artnet_sequence, frame)) {
+    if (!frame->terminated)
+      ++dmx.dropped;
     return;
   }
+  ++dmx.frames;
 
-  unsigned char *key = &request_buf[16], *value;
-  size_t key_length, value_length;
-  unsigned char *c;
-  bool connection_upgrade = false;
-  bool upgrade_websocket = false;
-  unsigned char *websocket_key = NULL;
-  size_t websocket_key_length = 0;
-
-  while (key < header_end) {
-    c = key;
-    while (*c != ':') {
-      *c = tolower(*c);
-      ++c;
-    }
-    key_length = c - key;
-    value = c + 2;
-
-    c = value;
-    while (c[0] != '\r' || c[1] != '\n') ++c;
-    value_length = c - value;
-
-    // printf("key=%.*s, value=%.*s\n", key_length, key, value_length, value);
-    if (key_length == 10 && !memcmp(key, "connection", 10)
-        && value_length == 7 && !memcmp(value, "Upgrade", 7))
-      connection_upgrade = true;
-    if (key_length == 7 && !memcmp(key, "upgrade", 7)
-        && value_length == 9 && !memcmp(value, "websocket", 9))
-      upgrade_websocket = true;
-    if (key_length == 17 && !memcmp(key, "sec-websocket-key", 17)) {
-      websocket_key = value;
-      websocket_key_length = value_length;
-    }
-
-    key = c + 2;
-  }
-
-  if (!connection_upgrade || !upgrade_websocket || !websocket_key) {
-    printf("Invalid handshake request.\n");
-    send_http_error("400 Bad Request", "Only websocket upgrades supported.");
-    request_buf_length = 0;
+  size_t start = DMX_ADDRESS - 1;
+  if (frame->slot_count < start + DMX_LEVEL_SLOTS)
     return;
-  }
-  
-  // Concatenate websocket key and GUID.
-  unsigned char *websocket_key_end = websocket_key + websocket_key_length;
-  strcpy(websocket_key_end, WS_GUID);
-
-  size_t hash_input_length = websocket_key_length + strlen(WS_GUID);
-  unsigned char hash_output[SHA1_SIZE];
-  mbedtls_sha1(websocket_key, hash_input_length, hash_output);
-
-  unsigned char base64_encoded_output[BASE64_ENCODED_SIZE];
-  size_t base64_encoded_length;
-  mbedtls_base64_encode(base64_encoded_output, BASE64_ENCODED_SIZE, &base64_encoded_length, hash_output, SHA1_SIZE);
-
-  const char *headers = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
-  tcp_write(client_pcb, headers, strlen(headers), TCP_WRITE_FLAG_MORE);
-  tcp_write(client_pcb, base64_encoded_output, base64_encoded_length, TCP_WRITE_FLAG_MORE | TCP_WRITE_FLAG_COPY);
-  tcp_write(client_pcb, "\r\n\r\n", 4, 0);
-
-  printf("Valid handshake request received. Sending response to client.\n");
-  tcp_output(client_pcb);
-  connection_state = ONLINE;
-  request_buf_length = 0;
-  
-  // If LED is on send info to client to update the UI.
-  if (*led_state)
-    send_led_state();
-}
-
-static void send_websocket_close_frame(void) {
-  static unsigned char close_frame[2] = {WS_FIN | WS_OP_CLOSE, 0};
-  if (connection_state == ONLINE) {
-    tcp_write(client_pcb, close_frame, 2, 0);
-    tcp_output(client_pcb);
-  }
-}
-
-static void set_led_state(bool on) {
-  if (on != *led_state) {
-    printf("Turning LED %s.\n", on ? "on" : "off");
-    gpio_put(LED_GPIO, on);
-    *led_state = on;
-  }
-  send_led_state();
+  const unsigned char *slots = &frame->slots[start];
+  server_stream_level((uint16_t)slots[0] << 8 | slots[1]);
+  if (STRIP_PIXELS > 0)
+    lighting_set_pixels(&slots[DMX_LEVEL_SLOTS], frame->slot_count - start - DMX_LEVEL_SLOTS);
 }
 
-static void handle_online(struct pbuf *p) {
-  static unsigned char request_buf[REQUEST_BUF_SIZE];
-  static size_t request_buf_length = 0;
-
-  u16_t n = pbuf_copy_partial(p, &request_buf[request_buf_length], p->tot_len, 0);
-  request_buf_length += n;
-  if (request_buf_length < 2)
-    return;
-
-  bool fin = request_buf[0] & WS_FIN;
-  bool mask = request_buf[1] & WS_MASK;
-  unsigned char payload_length = request_buf[1] & WS_PAYLOAD_LEN;
-
-  if (!fin || !mask || payload_length != 1) {
-    printf("Received invalid websocket frame.\n");
-    send_websocket_close_frame();
-    tcp_close(client_pcb);
-    client_pcb = NULL;
-    connection_state = LISTENING;
-    request_buf_length = 0;
-    return;
+static void dmx_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+  // A DMX packet normally fits in one pbuf and is parsed in place; only
+  // chained packets are copied.
+  static unsigned char packet[DMX_MAX_PACKET_SIZE];
+  const unsigned char *data = p->payload;
+  size_t length = p->len;
+  if (p->len != p->tot_len) {
+    length = pbuf_copy_partial(p, packet, sizeof(packet), 0);
+    data = packet;
   }
 
-  size_t frame_length = payload_length + 6;
-  if (request_buf_length < frame_length)
-    return;
-
-  unsigned char opcode = request_buf[0] & WS_OPCODE;
-  // Only the first byte of the masking key is need as the payload is always
-  // just one byte.
-  unsigned char masking_key = request_buf[2];
-
-  // for (size_t i = 0; i < request_buf_length; ++i)
-  //   printf("%x ", request_buf[i]);
-  // printf("\n");
-
-  if (opcode == WS_OP_BINARY) {
-    bool value = request_buf[6] ^ masking_key;
-    printf("Received request to turn LED %s.\n", value ? "on" : "off");
-    set_led_state(value);
-  } else if (opcode == WS_OP_CLOSE) {
-    printf("Received close frame.\n");
-    send_websocket_close_frame();
-    tcp_close(client_pcb);
-    client_pcb = NULL;
-    connection_state = LISTENING;
-    request_buf_length = 0;
-    return;
-  } else {
-    printf("Received frame with invalid opcode %u.\n", opcode);
-    send_websocket_close_frame();
-    tcp_close(client_pcb);
-    client_pcb = NULL;
-    connection_state = LISTENING;
-    request_buf_length = 0;
-    return;
-  }
-
-  // There could be extra bytes in the buffer that belong to the next frame.
-  size_t extra_bytes = request_buf_length - frame_length;
-  if (extra_bytes)
-    memmove(request_buf, &request_buf[frame_length], extra_bytes);
-  request_buf_length = extra_bytes;
-}
-
-static err_t recv_callback(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
-  if (connection_state == LISTENING) {
-    printf("How did we end up here?\n");
-    return ERR_OK;
-  }
-  if (pcb != client_pcb) {
-    printf("PCBs not matching?\n");
-    return ERR_OK;
-  }
-  if (!p) {
-    printf("Connection closed.\n");
-    tcp_close(client_pcb);
-    client_pcb = NULL;
-    connection_state = LISTENING;
-    return ERR_OK;
-  }
-  if (connection_state == HANDSHAKE)
-    handle_handshake(p);
-  else
-    handle_online(p);
-
+  struct DmxFrame frame;
+  if (dmx_parse(data, length, &frame) != DMX_NONE)
+    handle_dmx_frame(&frame);
   pbuf_free(p);
-  return ERR_OK;
 }
 
-static void err_callback(void *arg, err_t err) {
-  printf("Error code %d.\n", err);
+static bool listen_udp(u16_t port) {
+  struct udp_pcb *pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+  if (!pcb)
+    return false;
+  if (udp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK) {
+    udp_remove(pcb);
+    return false;
+  }
+  udp_recv(pcb, dmx_recv_callback, NULL);
+  return true;
 }
 
-static err_t accept_callback(void *arg, struct tcp_pcb *pcb, err_t err) {
-  if (pcb == NULL || err != ERR_OK)  {
-      printf("Failure in accept.\n");
-      return ERR_VAL;
-  }
-  if (connection_state != LISTENING) {
-    printf("Not in listening state.\n");
-    tcp_close(pcb);
-    return ERR_OK;
+// E1.31 is usually sent to the multicast group of the universe, Art-Net is
+// broadcast or unicast.
+static void start_dmx(void) {
+  if (!listen_udp(E131_PORT) || !listen_udp(ARTNET_PORT)) {
+    printf("Failed to listen for DMX.\n");
+    return;
   }
-  printf("Client connected.\n");
-  connection_state = HANDSHAKE;
-  client_pcb = pcb;
-  tcp_recv(client_pcb, recv_callback);
-  tcp_err(client_pcb, err_callback);
-  return ERR_OK;
+  ip4_addr_t group;
+  IP4_ADDR(&group, 239, 255, E131_UNIVERSE >> 8, E131_UNIVERSE & 0xFF);
+  if (igmp_joingroup(IP4_ADDR_ANY4, &group) != ERR_OK)
+    printf("Failed to join the E1.31 multicast group.\n");
+  printf("Listening for E1.31 universe %u and Art-Net universe %u.\n", E131_UNIVERSE, ARTNET_UNIVERSE);
 }
 
 static size_t get_string(char *dst, size_t limit) {
@@ -312,7 +199,9 @@ static size_t get_string(char *dst, size_t limit) {
   return i;
 }
 
-static void connect(void) {
+// Reads the credentials saved in the last flash sector by earlier firmware,
+// one page per save, the latest in the last programmed page.
+static bool load_legacy_credentials(struct WiFiCredentials *creds) {
   // Find first unprogrammed page from the last sector
   // (starting from the second page).
   unsigned char *p = (unsigned char *)(XIP_BASE + PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE + FLASH_PAGE_SIZE);
@@ -322,68 +211,342 @@ static void connect(void) {
   }
 
   // The previous page must be the last programmed page.
-  struct WiFiCredentials *creds = (struct WiFiCredentials *)(p - FLASH_PAGE_SIZE);
-  bool flash_empty = true;
+  const struct WiFiCredentials *saved = (const struct WiFiCredentials *)(p - FLASH_PAGE_SIZE);
   for (size_t i = 0; i < SSID_SIZE; ++i) {
-    if (creds->ssid[i] != 0xFF) {
-      flash_empty = false;
-      break;
+    if (saved->ssid[i] != (char)0xFF) {
+      *creds = *saved;
+      creds->ssid[SSID_SIZE - 1] = '\0';
+      creds->password[PASSWORD_SIZE - 1] = '\0';
+      return true;
     }
   }
-  if (!flash_empty) {
+  return false;
+}
+
+// The SSID and password are kept in one entry, "<ssid>\0<password>", so that
+// they are always replaced together.
+static bool load_credentials(struct WiFiCredentials *creds) {
+  char value[SSID_SIZE + PASSWORD_SIZE];
+  size_t length;
+  if (kv_get(&settings, WIFI_KEY, value, sizeof(value), &length) != KV_OK)
+    return false;
+  const char *separator = memchr(value, '\0', length);
+  if (!separator || separator - value >= SSID_SIZE || length - (separator - value) > PASSWORD_SIZE)
+    return false;
+  memcpy(creds->ssid, value, separator - value + 1);
+  memcpy(creds->password, separator + 1, length - (separator - value) - 1);
+  creds->password[length - (separator - value) - 1] = '\0';
+  return true;
+}
+
+static void save_credentials(const struct WiFiCredentials *creds) {
+  char value[SSID_SIZE + PASSWORD_SIZE];
+  size_t ssid_length = strlen(creds->ssid), password_length = strlen(creds->password);
+  memcpy(value, creds->ssid, ssid_length + 1);
+  memcpy(&value[ssid_length + 1], creds->password, password_length);
+  lighting_pause();
+  int status = kv_set(&settings, WIFI_KEY, value, ssid_length + 1 + password_length);
+  lighting_resume();
+  if (status != KV_OK)
+    printf("Failed to save credentials (%d).\n", status);
+}
+
+// Waits for the link to come up with an address, noting when the association
+// completed. Returns 0, PICO_ERROR_TIMEOUT or a negative CYW43_LINK_ status.
+static int wait_for_link(absolute_time_t until) {
+  bool joined = false;
+  while (true) {
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    if (status < 0)
+      return status;
+    if (status >= CYW43_LINK_NOIP && !joined) {
+      boot_timeline_mark(BOOT_JOINED);
+      joined = true;
+    }
+    if (status == CYW43_LINK_UP) {
+      boot_timeline_mark(BOOT_ADDRESS);
+      return 0;
+    }
+    if (time_reached(until))
+      return PICO_ERROR_TIMEOUT;
+    cyw43_arch_poll();
+    cyw43_arch_wait_for_work_until(until);
+  }
+}
+
+static int join_scan(const struct WiFiCredentials *creds) {
+  absolute_time_t until = make_timeout_time_ms(WIFI_CONNECT_TIMEOUT_MS);
+  int status;
+  do {
+    status = cyw43_arch_wifi_connect_async(creds->ssid, creds->password, CYW43_AUTH_WPA2_AES_PSK);
+    if (!status)
+      status = wait_for_link(until);
+    // The scan may miss the access point, so it is retried until the timeout.
+  } while (status == CYW43_LINK_NONET && !time_reached(until));
+  return status;
+}
+
+// Joins the access point of the last connection on its channel, without a
+// scan. The address still comes from DHCP as usual: the link is only up once
+// a lease is bound, and the boot has no clock to tell whether the cached one
+// is still valid.
+static int join_directed(const struct WiFiCredentials *creds, const struct WiFiLink *link) {
+  int status = cyw43_wifi_join(&cyw43_state, strlen(creds->ssid), (const uint8_t *)creds->ssid,
+                               strlen(creds->password), (const uint8_t *)creds->password,
+                               CYW43_AUTH_WPA2_AES_PSK, link->bssid, link->channel);
+  if (!status)
+    status = wait_for_link(make_timeout_time_ms(WIFI_DIRECTED_TIMEOUT_MS));
+  // Leave for the scan.
+  if (status)
+    cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+  return status;
+}
+
+static bool load_link(struct WiFiLink *link) {
+  size_t length;
+  return kv_get(&settings, WIFI_LINK_KEY, link, sizeof(*link), &length) == KV_OK && length == sizeof(*link);
+}
+
+// Caches where the connection went, if it differs from the cached one.
+static void save_link(const struct WiFiLink *cached) {
+  struct WiFiLink link = {0};
+  uint32_t channel_info[3];
+  if (cyw43_wifi_get_bssid(&cyw43_state, link.bssid)
+      || cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channel_info), (uint8_t *)channel_info, CYW43_ITF_STA))
+    return;
+  // The first word is the channel the radio is on.
+  link.channel = channel_info[0];
+  link.address = ip4_addr_get_u32(netif_ip4_addr(&cyw43_state.netif[CYW43_ITF_STA]));
+  if (cached && !memcmp(&link, cached, sizeof(link)))
+    return;
+  lighting_pause();
+  int status = kv_set(&settings, WIFI_LINK_KEY, &link, sizeof(link));
+  lighting_resume();
+  if (status != KV_OK)
+    printf("Failed to save the connection (%d).\n", status);
+}
+
+static void connect(void) {
+  struct WiFiCredentials creds;
+  struct WiFiLink link;
+  bool found = load_credentials(&creds);
+  if (!found && load_legacy_credentials(&creds)) {
+    printf("Moving credentials to the settings store.\n");
+    save_credentials(&creds);
+    found = true;
+  }
+  if (found) {
     printf("Found credentials in the flash.\n");
-    if (!cyw43_arch_wifi_connect_timeout_ms(creds->ssid, creds->password, CYW43_AUTH_WPA2_AES_PSK, 30000)) {
-      printf("Connected.\n");
+    bool cached = load_link(&link);
+    uint64_t start_us = time_us_64();
+    int status = -1;
+    if (cached) {
+      status = join_directed(&creds, &link);
+      if (status) {
+        printf("Directed join failed (%d) after %lu ms, scanning.\n", status, (unsigned long)((time_us_64() - start_us) / 1000));
+        start_us = time_us_64();
+      }
+    }
+    bool directed = !status;
+    if (status)
+      status = join_scan(&creds);
+    if (!status) {
+      // The address is the bound lease, so it was reused if DHCP gave the
+      // cached one back.
+      bool reused = cached && ip4_addr_get_u32(netif_ip4_addr(&cyw43_state.netif[CYW43_ITF_STA])) == link.address;
+      printf("Connected: %s join in %lu ms, %s address in %lu ms.\n", directed ? "directed" : "scanning",
+             (unsigned long)((boot_timeline_get(BOOT_JOINED) - start_us) / 1000), reused ? "reused" : "new",
+             (unsigned long)((boot_timeline_get(BOOT_ADDRESS) - boot_timeline_get(BOOT_JOINED)) / 1000));
+      save_link(cached ? &link : NULL);
       return;
     }
   }
 
-  struct WiFiCredentials new_creds;
   do {
     printf("Connection failed!\nEnter WiFi SSID: ");
-    get_string(new_creds.ssid, SSID_SIZE);
+    get_string(creds.ssid, SSID_SIZE);
     printf("\nEnter WiFi password: ");
-    get_string(new_creds.password, PASSWORD_SIZE);
+    get_string(creds.password, PASSWORD_SIZE);
     printf("\n");
-  } while (cyw43_arch_wifi_connect_timeout_ms(new_creds.ssid, new_creds.password, CYW43_AUTH_WPA2_AES_PSK, 30000));
+  } while (join_scan(&creds));
   printf("Connected.\n");
+  save_credentials(&creds);
+  save_link(NULL);
+}
+
+// A press is always handed over, even with the event ring full: the interrupt
+// stays disabled until the main loop has handled the press, so a lost event
+// would leave the button dead. Only one press is outstanding at a time, so a
+// single slot is enough. Console input takes at most one slot of the ring,
+// however much of it arrives, so it cannot crowd the button out either.
+static struct Event button_event;
+static atomic_bool button_event_pending;
+static atomic_bool console_event_queued;
+
+// Runs in interrupt context: only the LED command is issued to the lighting
+// engine here, everything else is deferred to the main loop through the event
+// ring.
+static void button_callback(uint gpio, uint32_t events) {
+  uint64_t now = time_us_64();
+  gpio_set_irq_enabled(BUTTON_GPIO, GPIO_IRQ_EDGE_RISE, false);
+  server_toggle_led();
+  struct Event event = {EVENT_BUTTON, now, time_us_64()};
+  if (!event_ring_push(&event_ring, &event)) {
+    button_event = event;
+    atomic_store_explicit(&button_event_pending, true, memory_order_release);
+  }
+}
+
+// Runs in interrupt context when there is input on USB stdio. Queues an event
+// only if none is waiting: the main loop reads all the input there is.
+static void console_callback(void *param) {
+  if (atomic_load_explicit(&console_event_queued, memory_order_relaxed))
+    return;
+  uint64_t now = time_us_64();
+  struct Event event = {EVENT_CONSOLE, now, now};
+  atomic_store_explicit(&console_event_queued, true, memory_order_relaxed);
+  if (!event_ring_push(&event_ring, &event))
+    atomic_store_explicit(&console_event_queued, false, memory_order_relaxed);
+}
 
-  uint32_t flash_offset;
-  uint32_t interrupts = save_and_disable_interrupts();
-  if (p >= (unsigned char *)XIP_BASE + PICO_FLASH_SIZE_BYTES) {
-    printf("Erasing flash.\n");
-    flash_range_erase(PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
-    printf("Erase complete.\n");
-    flash_offset = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+static void handle_console_input(void) {
+  // Input arriving from here on queues a new event.
+  atomic_store_explicit(&console_event_queued, false, memory_order_relaxed);
+  int c;
+  while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
+    if (c == 'b') {
+      boot_timeline_print();
+    } else if (c == 'l') {
+      server_print_latency();
+    } else if (c != '\r' && c != '\n') {
+      printf("Commands: b (boot timeline), l (request latency).\n");
+    }
+  }
+}
+
+static struct {
+  bool pending;
+  absolute_time_t next_check;
+  uint32_t low_ms;
+} button;
+
+static void handle_button_press(const struct Event *event) {
+  ++button_presses;
+  server_send_state();
+  uint64_t sent_us = time_us_64();
+  LOG_INFO("Button press: LED after %lu us, TCP send after %lu us.",
+           (unsigned long)(event->handled_us - event->time_us),
+           (unsigned long)(sent_us - event->time_us));
+  button.pending = true;
+  button.low_ms = 0;
+  button.next_check = make_timeout_time_ms(BUTTON_POLL_MS);
+}
+
+// Re-enables the button interrupt once the pin has settled low.
+static void debounce_button(void) {
+  if (!button.pending || !time_reached(button.next_check))
+    return;
+  button.low_ms = gpio_get(BUTTON_GPIO) ? 0 : button.low_ms + BUTTON_POLL_MS;
+  if (button.low_ms >= DEBOUNCE_MS) {
+    button.pending = false;
+    gpio_set_irq_enabled(BUTTON_GPIO, GPIO_IRQ_EDGE_RISE, true);
   } else {
-    flash_offset = (uint32_t)(p - XIP_BASE);
+    button.next_check = make_timeout_time_ms(BUTTON_POLL_MS);
+  }
+}
+
+// Writes the published state to the journal once it has held for the save
+// delay. The delay starts over with every change, so a live DMX stream does not
+// wear the flash; its last level is saved once the stream stops.
+static void save_led_state(void) {
+  const struct StateLog *state_log = server_state_log();
+  if (state_log->version == saved_state.version)
+    return;
+  if (!saved_state.pending || saved_state.pending_version != state_log->version) {
+    saved_state.pending = true;
+    saved_state.pending_version = state_log->version;
+    saved_state.due = make_timeout_time_ms(STATE_SAVE_DELAY_MS);
+    return;
   }
-  printf("Programming flash.\n");
-  flash_range_program(flash_offset, (const uint8_t *)&new_creds, FLASH_PAGE_SIZE);
-  printf("Programming complete.\n");
-  restore_interrupts(interrupts);
+  if (!time_reached(saved_state.due))
+    return;
+  uint64_t start = time_us_64();
+  lighting_pause();
+  journal_save(&saved_state.journal, state_log_latest(state_log), sizeof(struct CommandState));
+  lighting_resume();
+  saved_state.version = state_log->version;
+  saved_state.pending = false;
+  LOG_INFO("Saved LED state %lu in %lu us.", (unsigned long)state_log->version, (unsigned long)(time_us_64() - start));
 }
 
-void button_callback(uint gpio, uint32_t events) {
-  set_led_state(!*led_state);
+// Brings the LED back to the state saved before the reset. Runs before the
+// radio is initialised, so that the light is back within milliseconds of
+// power-on.
+static void restore_led_state(void) {
+  struct CommandState state;
+  if (!journal_load(&saved_state.journal, &state, sizeof(state)) || state.mode >= LIGHTING_MODE_COUNT
+      || (state.mode != LIGHTING_STEADY && state.period_ms == 0)) {
+    printf("No saved LED state.\n");
+    return;
+  }
+  server_restore_state(&state);
+  printf("Restored LED state (%s, level %u).\n", state.on ? "on" : "off", state.level);
+}
+
+static void process_events(void) {
+  struct Event event;
+  while (event_ring_pop(&event_ring, &event)) {
+    switch (event.type) {
+    case EVENT_BUTTON:
+      handle_button_press(&event);
+      break;
+    case EVENT_CONSOLE:
+      handle_console_input();
+      break;
+    }
+  }
+  if (atomic_load_explicit(&button_event_pending, memory_order_acquire)) {
+    event = button_event;
+    atomic_store_explicit(&button_event_pending, false, memory_order_relaxed);
+    handle_button_press(&event);
+  }
+  log_flush();
+  debounce_button();
+  save_led_state();
+  // Compacting the settings store ahead of time keeps the erase off the path
+  // of the next write.
+  if (kv_maintenance_due(&settings)) {
+    lighting_pause();
+    kv_maintain(&settings);
+    lighting_resume();
+  }
 }
 
 int main() {
   stdio_init_all();
+  boot_timeline_mark(BOOT_STDIO);
+
+  lighting_init();
+  restore_led_state();
+  kv_init(&settings);
+  boot_timeline_mark(BOOT_STORAGE);
+
+  // A new epoch on every boot, so that clients do not take versions from
+  // before a restart for current ones. The restored state is already saved.
+  server_init(get_rand_32());
+  saved_state.version = server_state_log()->version;
 
   gpio_init(BUTTON_GPIO);
   gpio_set_dir(BUTTON_GPIO, false);
-  gpio_set_irq_enabled_with_callback(BUTTON_GPIO, GPIO_IRQ_EDGE_RISE, true, button_callback);
   gpio_pull_down(BUTTON_GPIO);
-
-  gpio_init(LED_GPIO);
-  gpio_set_dir(LED_GPIO, true);
+  gpio_set_irq_enabled_with_callback(BUTTON_GPIO, GPIO_IRQ_EDGE_RISE, true, button_callback);
 
   if (cyw43_arch_init()) {
     printf("Failed to initialize.\n");
     return 1;
   }
   cyw43_arch_enable_sta_mode();
+  boot_timeline_mark(BOOT_RADIO);
   connect();
 
   struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
@@ -397,18 +560,51 @@ int main() {
     printf("Failed to bind.\n");
     return 1;
   }
-  
-  pcb = tcp_listen_with_backlog(pcb, 1);
+  boot_timeline_mark(BOOT_BOUND);
+
+  pcb = tcp_listen_with_backlog(pcb, MAX_CONNECTIONS);
   if (!pcb) {
     printf("Failed to listen.\n");
     return 1;
   }
-  tcp_accept(pcb, accept_callback);
-
+  tcp_accept(pcb, server_accept);
+  boot_timeline_mark(BOOT_LISTENING);
+  boot_timeline_print();
+#if BOOT_READY_BUDGET_MS
+  if (boot_timeline_get(BOOT_LISTENING) > BOOT_READY_BUDGET_MS * 1000ull)
+    printf("Boot took longer than its budget of %u ms.\n", BOOT_READY_BUDGET_MS);
+#endif
+  // The console is free for commands once the credentials have been read.
+  stdio_set_chars_available_callback(console_callback, NULL);
+
+  start_dmx();
+
+  // Sleep until the radio, a GPIO interrupt or an lwIP timer has work
+  // instead of polling every millisecond. The wakeup count is reported
+  // periodically to keep an eye on idle power.
+  uint32_t wakeups = 0;
+  absolute_time_t next_report = make_timeout_time_ms(WAKEUP_REPORT_MS);
   while (true) {
     cyw43_arch_poll();
-    sleep_ms(1);
+    process_events();
+    absolute_time_t until = next_report;
+    if (button.pending && absolute_time_diff_us(button.next_check, until) > 0)
+      until = button.next_check;
+    if (saved_state.pending && absolute_time_diff_us(saved_state.due, until) > 0)
+      until = saved_state.due;
+    // Records left over from a bounded flush go out on the next iteration.
+    if (log_pending())
+      until = get_absolute_time();
+    cyw43_arch_wait_for_work_until(until);
+    ++wakeups;
+    if (time_reached(next_report)) {
+      LOG_INFO("Main loop woke %lu times in %u ms.", (unsigned long)wakeups, WAKEUP_REPORT_MS);
+      if (dmx.frames || dmx.dropped)
+        LOG_INFO("DMX frames applied %lu, dropped %lu.", (unsigned long)dmx.frames, (unsigned long)dmx.dropped);
+      wakeups = 0;
+      next_report = make_timeout_time_ms(WAKEUP_REPORT_MS);
+    }
   }
 
   return 0;
-}
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "metrics.h"
+
+// Room kept for the truncation marker.
+#define METRICS_RESERVE 32
+
+static void append(struct Metrics *metrics, const char *format, ...) {
+  if (metrics->truncated)
+    return;
+  va_list args;
+  va_start(args, format);
+  size_t room = metrics->size - METRICS_RESERVE - metrics->length;
+  int length = vsnprintf(&metrics->buf[metrics->length], room, format, args);
+  va_end(args);
+  if (length < 0 || (size_t)length >= room) {
+    metrics->buf[metrics->length] = '\0';
+    metrics->truncated = true;
+    return;
+  }
+  metrics->length += length;
+}
+
+void metrics_init(struct Metrics *metrics, char *buf, size_t size) {
+  metrics->buf = buf;
+  metrics->size = size;
+  metrics->length = 0;
+  metrics->truncated = false;
+  buf[0] = '\0';
+}
+
+void metrics_type(struct Metrics *metrics, const char *name, const char *type) {
+  append(metrics, "# TYPE %s %s\n", name, type);
+}
+
+void metrics_sample(struct Metrics *metrics, const char *name, const char *labels, unsigned long long value) {
+  if (labels)
+    append(metrics, "%s{%s} %llu\n", name, labels, value);
+  else
+    append(metrics, "%s %llu\n", name, value);
+}
+
+void metrics_add(struct Metrics *metrics, const char *name, const char *type, unsigned long long value) {
+  metrics_type(metrics, name, type);
+  metrics_sample(metrics, name, NULL, value);
+}
+
+const char *metrics_finish(struct Metrics *metrics) {
+  // append stops METRICS_RESERVE short of the end, which leaves room here.
+  if (metrics->truncated)
+    snprintf(&metrics->buf[metrics->length], METRICS_RESERVE, "# truncated\n");
+  return metrics->buf;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Writer for the Prometheus text format served on /metrics. Samples that do
+// not fit in the buffer are dropped whole and the page is marked truncated.
+
+struct Metrics {
+  char *buf;
+  size_t size;
+  size_t length;
+  bool truncated;
+};
+
+void metrics_init(struct Metrics *metrics, char *buf, size_t size);
+
+// Declares the type ("counter" or "gauge") of the samples that follow.
+void metrics_type(struct Metrics *metrics, const char *name, const char *type);
+
+// Adds a sample. labels is the inside of the braces, e.g. pool="TCP_PCB", or
+// NULL for none.
+void metrics_sample(struct Metrics *metrics, const char *name, const char *labels, unsigned long long value);
+
+// Adds a sample, declaring its type first.
+void metrics_add(struct Metrics *metrics, const char *name, const char *type, unsigned long long value);
+
+// Adds the lwIP link, heap and pool statistics and the C heap usage. In
+// metrics_lwip.c, which only builds for the board.
+void metrics_add_lwip(struct Metrics *metrics);
+
+// Terminates the page, noting whether it was truncated. Returns it.
+const char *metrics_finish(struct Metrics *metrics);
@@ -0,0 +1,58 @@
+#include <malloc.h>
+#include <stdio.h>
+
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+
+#include "metrics.h"
+
+// Bounds of the heap, from the linker script.
+extern char __end__, __HeapLimit;
+
+static const char *const pool_names[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name, num, size, desc) #name,
+#include "lwip/priv/memp_std.h"
+};
+
+static void add_link(struct Metrics *metrics) {
+  const struct stats_proto *link = &lwip_stats.link;
+  metrics_type(metrics, "lwip_link_packets_total", "counter");
+  metrics_sample(metrics, "lwip_link_packets_total", "event=\"xmit\"", link->xmit);
+  metrics_sample(metrics, "lwip_link_packets_total", "event=\"recv\"", link->recv);
+  metrics_sample(metrics, "lwip_link_packets_total", "event=\"drop\"", link->drop);
+  metrics_sample(metrics, "lwip_link_packets_total", "event=\"chkerr\"", link->chkerr);
+  metrics_sample(metrics, "lwip_link_packets_total", "event=\"lenerr\"", link->lenerr);
+  metrics_sample(metrics, "lwip_link_packets_total", "event=\"memerr\"", link->memerr);
+  metrics_sample(metrics, "lwip_link_packets_total", "event=\"err\"", link->err);
+}
+
+static void add_pools(struct Metrics *metrics) {
+  static const char *const names[] = {"lwip_memp_avail", "lwip_memp_used", "lwip_memp_max", "lwip_memp_errors_total"};
+  char labels[32];
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+    metrics_type(metrics, names[i], i == 3 ? "counter" : "gauge");
+    for (int pool = 0; pool < MEMP_MAX; ++pool) {
+      const struct stats_mem *stats = lwip_stats.memp[pool];
+      if (!stats)
+        continue;
+      unsigned long long values[] = {stats->avail, stats->used, stats->max, stats->err};
+      snprintf(labels, sizeof(labels), "pool=\"%s\"", pool_names[pool]);
+      metrics_sample(metrics, names[i], labels, values[i]);
+    }
+  }
+}
+
+void metrics_add_lwip(struct Metrics *metrics) {
+  add_link(metrics);
+  metrics_add(metrics, "lwip_mem_used_bytes", "gauge", lwip_stats.mem.used);
+  metrics_add(metrics, "lwip_mem_max_bytes", "gauge", lwip_stats.mem.max);
+  metrics_add(metrics, "lwip_mem_errors_total", "counter", lwip_stats.mem.err);
+  add_pools(metrics);
+  metrics_add(metrics, "smart_led_pbuf_pool_size", "gauge", lwip_stats.memp[MEMP_PBUF_POOL]->avail);
+  metrics_add(metrics, "smart_led_pbuf_pool_high_water", "gauge", lwip_stats.memp[MEMP_PBUF_POOL]->max);
+
+  struct mallinfo heap = mallinfo();
+  metrics_add(metrics, "smart_led_heap_size_bytes", "gauge", &__HeapLimit - &__end__);
+  metrics_add(metrics, "smart_led_heap_arena_bytes", "gauge", heap.arena);
+  metrics_add(metrics, "smart_led_heap_used_bytes", "gauge", heap.uordblks);
+}
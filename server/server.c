@@ -0,0 +1,693 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+#include "boot_timeline.h"
+#include "command.h"
+#include "connection.h"
+#include "histogram.h"
+#include "http.h"
+#include "json.h"
+#include "lighting.h"
+#include "log.h"
+#include "metrics.h"
+#include "server.h"
+#include "state_log.h"
+#include "ws.h"
+
+#define LED_CHANNEL_COUNT 1
+// In TCP coarse timer ticks of 500 ms.
+#define POLL_INTERVAL 2
+#define HTTP_REQUEST_TIMEOUT_MS 5000
+#define IDLE_PING_MS 20000
+#define PONG_TIMEOUT_MS 5000
+// Minimum time between publishing two levels streamed over DMX.
+#define STREAM_PUBLISH_MS 250
+#define HTTP_RESPONSE_FORMAT "HTTP/1.1 %s\r\nServer: smart-led-server\r\nContent-Length: %zu\r\nContent-Type: %s\r\nConnection: %s\r\n\r\n"
+#define HTTP_HEADER_SIZE 256
+#define HTTP_BODY_SIZE 256
+#define METRICS_BODY_SIZE 6144
+
+_Static_assert(LIGHTING_STEADY == CMD_MODE_STEADY && LIGHTING_BLINK == CMD_MODE_BLINK
+               && LIGHTING_BREATHE == CMD_MODE_BREATHE && LIGHTING_STROBE == CMD_MODE_STROBE
+               && LIGHTING_CHASE == CMD_MODE_CHASE && LIGHTING_MODE_COUNT == CMD_MODE_COUNT,
+               "lighting modes must match the protocol");
+
+static bool led_on;
+// Brightness while on, kept while the LED is off.
+static uint16_t led_brightness = LED_MAX_LEVEL;
+static struct LightingEffect led_effect;
+static struct StateLog state_log;
+static uint64_t stream_published_us;
+// Stages of a WebSocket request: from the segment reaching recv_callback to
+// the message being decoded, to its commands being handed to the lighting
+// engine (which times its own part), to the reply leaving through
+// tcp_output and to the peer acknowledging it.
+static struct {
+  struct Histogram recv_decode;
+  struct Histogram decode_apply;
+  struct Histogram apply_output;
+  struct Histogram apply_acked;
+} latency;
+
+// Application counters for /metrics.
+static struct {
+  uint32_t accepted;
+  uint32_t rejected;
+  uint32_t frames_in;
+  uint32_t frames_out;
+  uint32_t http_errors;
+  uint32_t websocket_errors;
+  uint32_t command_errors;
+} counters;
+
+// Queues a response; the caller sends it with tcp_output, once for all the
+// responses to a pipelined burst. Returns false if it did not fit in the send
+// buffer.
+static bool send_http_response(struct Connection *connection, const char *status, const char *content_type, const char *body, bool keep_alive) {
+  char header[HTTP_HEADER_SIZE];
+  size_t body_length = strlen(body);
+  int header_length = snprintf(header, sizeof(header), HTTP_RESPONSE_FORMAT, status, body_length, content_type,
+                               keep_alive ? "keep-alive" : "close");
+  if (header_length < 0 || (size_t)header_length >= sizeof(header))
+    return false;
+  // The body may be a buffer shared between connections, so lwIP copies both.
+  if (tcp_write(connection->pcb, header, header_length, body_length ? TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE : TCP_WRITE_FLAG_COPY) != ERR_OK)
+    return false;
+  return !body_length || tcp_write(connection->pcb, body, body_length, TCP_WRITE_FLAG_COPY) == ERR_OK;
+}
+
+static uint16_t led_level(void) {
+  return led_on ? led_brightness : 0;
+}
+
+static struct CommandState current_state(void) {
+  return (struct CommandState){
+    .on = led_on,
+    .level = led_brightness,
+    .mode = led_effect.mode,
+    .period_ms = led_effect.period_ms,
+    .duty = led_effect.duty,
+    .phase = led_effect.phase,
+  };
+}
+
+// Gives the current state the next version and sends it to every client.
+// Changes are only published from the main loop, button presses included, so
+// the versions follow the order in which the clients are told.
+void server_send_state(void) {
+  struct CommandState state = current_state();
+  if (!state_log_record(&state_log, &state))
+    return;
+  // The frame is encoded once and copied to every client.
+  unsigned char frame[2 + CMD_STATE_SIZE] = {WS_FIN | WS_OP_BINARY, CMD_STATE_SIZE};
+  command_encode_state(&frame[2], state_log_latest(&state_log));
+  size_t clients = connection_broadcast(frame, sizeof(frame));
+  counters.frames_out += clients;
+  LOG_INFO("Sent LED state %lu (%s) to %zu clients.", (unsigned long)state_log.version, state.on ? "on" : "off", clients);
+}
+
+// Sends the current state to a client that missed a broadcast, once its send
+// buffer has room. The states in between are skipped: clients only keep the
+// latest one.
+static void send_missed_state(struct Connection *connection) {
+  if (connection->state != ONLINE || !connection->resync_pending)
+    return;
+  unsigned char frame[2 + CMD_STATE_SIZE] = {WS_FIN | WS_OP_BINARY, CMD_STATE_SIZE};
+  command_encode_state(&frame[2], state_log_latest(&state_log));
+  if (tcp_write(connection->pcb, frame, sizeof(frame), TCP_WRITE_FLAG_COPY) != ERR_OK)
+    return;
+  connection->resync_pending = false;
+  tcp_output(connection->pcb);
+  ++counters.frames_out;
+}
+
+// Brings a new client up to date: with the states it missed if it says which
+// version it saw last and they are still in the history, otherwise with the
+// current state. Returns false if it did not fit in the send buffer.
+static bool send_state_sync(struct Connection *connection, const struct HttpRequest *request) {
+  uint32_t epoch, version, first;
+  bool snapshot = !http_query_uint(request, "epoch", &epoch) || !http_query_uint(request, "version", &version)
+                  || !state_log_since(&state_log, epoch, version, &first);
+  if (snapshot)
+    first = state_log.version;
+  unsigned char count = state_log.version + 1 - first;
+
+  unsigned char sync[2 + CMD_SYNC_SIZE] = {WS_FIN | WS_OP_BINARY, CMD_SYNC_SIZE};
+  command_encode_sync(&sync[2], state_log.epoch, state_log.version, count, snapshot);
+  if (tcp_write(connection->pcb, sync, sizeof(sync), TCP_WRITE_FLAG_COPY) != ERR_OK)
+    return false;
+  unsigned char frame[2 + CMD_STATE_SIZE] = {WS_FIN | WS_OP_BINARY, CMD_STATE_SIZE};
+  for (uint32_t v = first; v != state_log.version + 1; ++v) {
+    command_encode_state(&frame[2], state_log_get(&state_log, v));
+    if (tcp_write(connection->pcb, frame, sizeof(frame), TCP_WRITE_FLAG_COPY) != ERR_OK)
+      return false;
+  }
+  counters.frames_out += 1 + count;
+  LOG_INFO("Synced client to state %lu with %s of %u states.", (unsigned long)state_log.version,
+           snapshot ? "a snapshot" : "a delta", count);
+  return true;
+}
+
+// Completes the WebSocket opening handshake of a request with a key. Returns
+// false if the response did not fit in the send buffer.
+static bool accept_websocket(struct Connection *connection, const struct HttpRequest *request) {
+  char accept[WS_ACCEPT_SIZE];
+  ws_accept_key(request->websocket_key, request->websocket_key_length, accept);
+
+  const char *headers = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ";
+  if (tcp_write(connection->pcb, headers, strlen(headers), TCP_WRITE_FLAG_MORE) != ERR_OK
+      || tcp_write(connection->pcb, accept, sizeof(accept), TCP_WRITE_FLAG_MORE | TCP_WRITE_FLAG_COPY) != ERR_OK
+      || tcp_write(connection->pcb, "\r\n\r\n", 4, 0) != ERR_OK)
+    return false;
+
+  // Send the state so that the client can update its UI.
+  if (!send_state_sync(connection, request))
+    return false;
+
+  LOG_INFO("Valid handshake request received. Sending response to client.");
+  connection->state = ONLINE;
+  // The decoder takes over the storage of the parser, and with it the request.
+  ws_decoder_init(&connection->decoder, connection->request_buf, REQUEST_BUF_SIZE);
+  return true;
+}
+
+static void send_websocket_frame(struct Connection *connection, unsigned char opcode, const unsigned char *payload, size_t length) {
+  unsigned char header[WS_MAX_HEADER_SIZE];
+  size_t header_length = ws_encode_header(header, opcode, length);
+  tcp_write(connection->pcb, header, header_length, length ? TCP_WRITE_FLAG_MORE | TCP_WRITE_FLAG_COPY : TCP_WRITE_FLAG_COPY);
+  if (length)
+    tcp_write(connection->pcb, payload, length, TCP_WRITE_FLAG_COPY);
+  tcp_output(connection->pcb);
+  ++counters.frames_out;
+}
+
+static void send_websocket_close_frame(struct Connection *connection, int status) {
+  if (connection->state == ONLINE) {
+    unsigned char payload[2] = {status >> 8, status};
+    send_websocket_frame(connection, WS_OP_CLOSE, payload, 2);
+  }
+}
+
+// How a change switches the LED. LED_UNCHANGED leaves it on or off as it is
+// when the change is applied.
+enum LedSwitch {
+  LED_OFF,
+  LED_ON,
+  LED_UNCHANGED,
+};
+
+// Returns whether the state changed. The button interrupt switches the LED as
+// well, so the update, including reading whether it is on, is done with
+// interrupts disabled.
+static bool apply_led_state(enum LedSwitch led_switch, uint16_t brightness, uint32_t transition_ms) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  bool on = led_switch == LED_UNCHANGED ? led_on : led_switch == LED_ON;
+  bool changed = on != led_on || brightness != led_brightness;
+  if (changed) {
+    led_on = on;
+    led_brightness = brightness;
+    lighting_set_level(led_level(), transition_ms);
+  }
+  restore_interrupts(interrupts);
+  if (changed)
+    LOG_INFO("Turning LED %s (level %u, %lu ms).", on ? "on" : "off", brightness, (unsigned long)transition_ms);
+  return changed;
+}
+
+void server_toggle_led(void) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  led_on = !led_on;
+  lighting_set_level(led_level(), 0);
+  restore_interrupts(interrupts);
+}
+
+static bool toggle_led_state(void) {
+  server_toggle_led();
+  LOG_INFO("Turning LED %s.", led_on ? "on" : "off");
+  return true;
+}
+
+// A fade to zero switches the LED off and keeps the brightness for the next
+// time it is switched on.
+static bool fade_led(uint16_t level, uint32_t transition_ms) {
+  if (level == 0)
+    return apply_led_state(LED_OFF, led_brightness, transition_ms);
+  return apply_led_state(LED_ON, level, transition_ms);
+}
+
+// Levels streamed over DMX arrive dozens of times a second. Each is applied at
+// once, but a changed level is published at most every STREAM_PUBLISH_MS, so
+// clients and the flash journal are not flooded. Sources keep repeating their
+// frames, so the last level of a fade is published with a frame after it.
+void server_stream_level(uint16_t level) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  if (level != led_level()) {
+    led_on = level > 0;
+    if (level)
+      led_brightness = level;
+    lighting_set_level(level, 0);
+  }
+  restore_interrupts(interrupts);
+
+  const struct CommandState *published = state_log_latest(&state_log);
+  uint64_t now = time_us_64();
+  if (level != (published->on ? published->level : 0) && now - stream_published_us >= STREAM_PUBLISH_MS * 1000) {
+    stream_published_us = now;
+    server_send_state();
+  }
+}
+
+static bool set_led_effect(const struct Command *command) {
+  struct LightingEffect effect = {
+    .mode = command->mode,
+    .duty = command->duty,
+    .phase = command->phase,
+    .period_ms = command->mode == CMD_MODE_STEADY ? 0 : command->period_ms,
+  };
+  if (effect.mode == led_effect.mode && effect.duty == led_effect.duty
+      && effect.phase == led_effect.phase && effect.period_ms == led_effect.period_ms)
+    return false;
+  led_effect = effect;
+  lighting_set_effect(&effect);
+  LOG_INFO("Starting effect %u (period %u ms).", effect.mode, effect.period_ms);
+  return true;
+}
+
+static void set_led_state(bool on) {
+  apply_led_state(on ? LED_ON : LED_OFF, led_brightness, 0);
+  server_send_state();
+}
+
+static void handle_command_batch(struct Connection *connection, const unsigned char *payload, size_t length, uint64_t decoded_us) {
+  struct CommandBatch batch;
+  struct Command command;
+  struct CommandResult results[CMD_MAX_RESULTS];
+  size_t result_count = 0;
+  bool changed = false;
+  bool boot = false;
+
+  // Channel 0 is the LED; command_batch_open has rejected any other.
+  int status = command_batch_open(&batch, payload, length, LED_CHANNEL_COUNT);
+  if (status == CMD_STATUS_OK) {
+    while (command_batch_next(&batch, &command)) {
+      switch (command.opcode) {
+      case CMD_SET:
+        changed |= apply_led_state(command.value ? LED_ON : LED_OFF, led_brightness, 0);
+        break;
+      case CMD_TOGGLE:
+        changed |= toggle_led_state();
+        break;
+      case CMD_FADE:
+        changed |= fade_led(command.value, command.transition_ms);
+        break;
+      case CMD_EFFECT:
+        changed |= set_led_effect(&command);
+        break;
+      case CMD_QUERY:
+        results[result_count++] = (struct CommandResult){command.channel, led_level()};
+        break;
+      case CMD_BOOT:
+        boot = true;
+        break;
+      }
+    }
+  }
+  uint64_t applied_us = time_us_64();
+  histogram_record(&latency.decode_apply, applied_us - decoded_us);
+  if (status != CMD_STATUS_OK)
+    ++counters.command_errors;
+  LOG_INFO("Received batch %u with %u commands (status %d).", batch.sequence, batch.count, status);
+
+  unsigned char ack[CMD_ACK_MAX_SIZE];
+  size_t ack_length = command_encode_ack(ack, batch.sequence, status, results, result_count);
+  send_websocket_frame(connection, WS_OP_BINARY, ack, ack_length);
+  histogram_record(&latency.apply_output, time_us_64() - applied_us);
+  // Only one reply is timed at a time; the sent callback finishes it.
+  if (!connection->reply_pending) {
+    connection->reply_pending = true;
+    connection->reply_start_us = applied_us;
+    connection->reply_end_seq = connection->pcb->snd_lbb;
+  }
+  if (boot) {
+    uint64_t times_us[BOOT_PHASE_COUNT];
+    for (int phase = 0; phase < BOOT_PHASE_COUNT; ++phase)
+      times_us[phase] = boot_timeline_get(phase);
+    unsigned char timeline[CMD_BOOT_TIMELINE_HEADER_SIZE + 4 * BOOT_PHASE_COUNT];
+    send_websocket_frame(connection, WS_OP_BINARY, timeline, command_encode_boot_timeline(timeline, times_us, BOOT_PHASE_COUNT));
+  }
+
+  // Other clients learn about the changes through one state update per batch.
+  if (changed)
+    server_send_state();
+}
+
+static bool handle_message(struct Connection *connection, unsigned char opcode, unsigned char *payload, size_t length) {
+  // recv_callback stamped the segment that completed the message.
+  uint64_t decoded_us = time_us_64();
+  if (opcode == WS_OP_BINARY)
+    histogram_record(&latency.recv_decode, decoded_us - connection->last_activity_us);
+  if (opcode == WS_OP_BINARY && length == 1) {
+    bool value = payload[0];
+    set_led_state(value);
+    histogram_record(&latency.decode_apply, time_us_64() - decoded_us);
+    LOG_INFO("Received request to turn LED %s.", value ? "on" : "off");
+  } else if (opcode == WS_OP_BINARY) {
+    handle_command_batch(connection, payload, length, decoded_us);
+  } else {
+    LOG_WARN("Ignoring unsupported message (opcode %u, %zu bytes).", opcode, length);
+  }
+  return true;
+}
+
+static bool handle_frame(void *arg, unsigned char opcode, unsigned char *payload, size_t length) {
+  struct Connection *connection = arg;
+  ++counters.frames_in;
+  switch (opcode) {
+  case WS_OP_PING:
+    send_websocket_frame(connection, WS_OP_PONG, payload, length);
+    return true;
+  case WS_OP_PONG:
+    return true;
+  case WS_OP_CLOSE:
+    // Echo the status code back to complete the closing handshake.
+    LOG_INFO("Received close frame.");
+    send_websocket_frame(connection, WS_OP_CLOSE, payload, length < 2 ? 0 : 2);
+    return false;
+  default:
+    return handle_message(connection, opcode, payload, length);
+  }
+}
+
+static void format_state(char *body, size_t size) {
+  const struct CommandState *state = state_log_latest(&state_log);
+  snprintf(body, size, "{\"on\":%s,\"level\":%u,\"mode\":%u,\"period_ms\":%u,\"duty\":%u,\"phase\":%u,"
+           "\"epoch\":%lu,\"version\":%lu}\n",
+           state->on ? "true" : "false", state->level, state->mode, state->period_ms, state->duty, state->phase,
+           (unsigned long)state_log.epoch, (unsigned long)state->version);
+}
+
+static void format_health(char *body, size_t size) {
+  size_t clients = 0;
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i)
+    clients += connections[i].state == ONLINE;
+  snprintf(body, size, "{\"status\":\"ok\",\"uptime_ms\":%llu,\"clients\":%zu}\n",
+           (unsigned long long)(time_us_64() / 1000), clients);
+}
+
+static const char *format_metrics(void) {
+  static char body[METRICS_BODY_SIZE];
+  struct Metrics metrics;
+  metrics_init(&metrics, body, sizeof(body));
+  metrics_add(&metrics, "smart_led_uptime_seconds", "gauge", time_us_64() / 1000000);
+  metrics_add(&metrics, "smart_led_connections_accepted_total", "counter", counters.accepted);
+  metrics_add(&metrics, "smart_led_connections_rejected_total", "counter", counters.rejected);
+  size_t clients = 0;
+  for (size_t i = 0; i < MAX_CONNECTIONS; ++i)
+    clients += connections[i].state == ONLINE;
+  metrics_add(&metrics, "smart_led_websocket_clients", "gauge", clients);
+  metrics_add(&metrics, "smart_led_frames_received_total", "counter", counters.frames_in);
+  metrics_add(&metrics, "smart_led_frames_sent_total", "counter", counters.frames_out);
+  metrics_type(&metrics, "smart_led_decode_errors_total", "counter");
+  metrics_sample(&metrics, "smart_led_decode_errors_total", "protocol=\"http\"", counters.http_errors);
+  metrics_sample(&metrics, "smart_led_decode_errors_total", "protocol=\"websocket\"", counters.websocket_errors);
+  metrics_sample(&metrics, "smart_led_decode_errors_total", "protocol=\"command\"", counters.command_errors);
+  metrics_add(&metrics, "smart_led_state_version", "gauge", state_log.version);
+  server_add_platform_metrics(&metrics);
+  return metrics_finish(&metrics);
+}
+
+// Applies a PUT /state body such as {"on": true, "level": 32768,
+// "transition_ms": 500}. A level switches the LED on unless "on" says
+// otherwise, and a level of 0 switches it off. Returns false if the body is
+// not valid.
+static bool update_state(const char *json, size_t length) {
+  bool on = false;
+  uint32_t level = led_brightness, transition_ms = 0;
+  if (!json_is_object(json, length))
+    return false;
+  int has_on = json_get_bool(json, length, "on", &on);
+  int has_level = json_get_uint(json, length, "level", LED_MAX_LEVEL, &level);
+  int has_transition = json_get_uint(json, length, "transition_ms", UINT16_MAX, &transition_ms);
+  if (has_on == JSON_INVALID || has_level == JSON_INVALID || has_transition == JSON_INVALID)
+    return false;
+
+  enum LedSwitch led_switch = LED_UNCHANGED;
+  if (has_level == JSON_FOUND && level == 0) {
+    led_switch = LED_OFF;
+    level = led_brightness;
+  } else if (has_on == JSON_FOUND) {
+    led_switch = on ? LED_ON : LED_OFF;
+  } else if (has_level == JSON_FOUND) {
+    led_switch = LED_ON;
+  }
+  if (apply_led_state(led_switch, level, transition_ms))
+    server_send_state();
+  return true;
+}
+
+// Handles one request and queues its response. Returns false if the
+// connection is to be closed afterwards, or aborted when send_failed is set.
+static bool handle_http_request(struct Connection *connection, const struct HttpRequest *request, bool *send_failed) {
+  char body[HTTP_BODY_SIZE];
+  const char *status = "200 OK", *content_type = "application/json", *content = body;
+  bool keep_alive = request->keep_alive;
+
+  if (http_target_is(request, "/")) {
+    if (request->method == HTTP_GET && request->upgrade_websocket && request->websocket_key_length > 0) {
+      *send_failed = !accept_websocket(connection, request);
+      return !*send_failed;
+    }
+    LOG_WARN("Invalid handshake request.");
+    status = "400 Bad Request";
+    content_type = "text/plain";
+    strcpy(body, "Only websocket upgrades supported.\n");
+    keep_alive = false;
+  } else if (http_target_is(request, "/state") && request->method == HTTP_GET) {
+    format_state(body, sizeof(body));
+  } else if (http_target_is(request, "/state") && request->method == HTTP_PUT) {
+    if (update_state(request->body, request->content_length)) {
+      format_state(body, sizeof(body));
+    } else {
+      status = "400 Bad Request";
+      content_type = "text/plain";
+      strcpy(body, "Invalid state.\n");
+    }
+  } else if (http_target_is(request, "/health") && request->method == HTTP_GET) {
+    format_health(body, sizeof(body));
+  } else if (http_target_is(request, "/metrics") && request->method == HTTP_GET) {
+    content_type = "text/plain; version=0.0.4";
+    content = format_metrics();
+  } else if (http_target_is(request, "/state") || http_target_is(request, "/health") || http_target_is(request, "/metrics")) {
+    status = "405 Method Not Allowed";
+    content_type = "text/plain";
+    strcpy(body, "Method not allowed.\n");
+  } else {
+    status = "404 Not Found";
+    content_type = "text/plain";
+    strcpy(body, "Not found.\n");
+  }
+
+  *send_failed = !send_http_response(connection, status, content_type, content, keep_alive);
+  return keep_alive && !*send_failed;
+}
+
+// Handles one segment of the stream. Requests are answered in order, so a
+// client may pipeline several of them and keep the connection open between
+// them; bytes after an upgrade request go on to the frame decoder. Returns
+// false once the connection has been closed, with the result for lwIP.
+static bool handle_segment(struct Connection *connection, unsigned char *data, size_t length, err_t *result) {
+  while (length > 0 && connection->state == HANDSHAKE) {
+    size_t consumed;
+    const struct HttpRequest *request;
+    int status = http_parse(&connection->parser, (const char *)data, length, &consumed, &request);
+    data += consumed;
+    length -= consumed;
+    if (status == HTTP_PARSE_INCOMPLETE)
+      break;
+
+    bool keep_alive = false, send_failed = false;
+    if (status == HTTP_PARSE_DONE) {
+      keep_alive = handle_http_request(connection, request, &send_failed);
+    } else if (status == HTTP_PARSE_TOO_LARGE) {
+      ++counters.http_errors;
+      LOG_WARN("HTTP request too large.");
+      send_failed = !send_http_response(connection, "413 Content Too Large", "text/plain", "Request too large.\n", false);
+    } else {
+      ++counters.http_errors;
+      LOG_WARN("Invalid HTTP request.");
+      send_failed = !send_http_response(connection, "400 Bad Request", "text/plain", "Invalid request.\n", false);
+    }
+    if (send_failed) {
+      LOG_WARN("HTTP send buffer full (slot %u).", (unsigned)(connection - connections));
+      *result = connection_abort(connection);
+      return false;
+    }
+    if (connection->state == ONLINE)
+      break;
+    if (!keep_alive) {
+      tcp_output(connection->pcb);
+      *result = connection_close(connection);
+      return false;
+    }
+    // The next request starts right after this one, and its timeout with it.
+    http_parser_init(&connection->parser, (char *)connection->request_buf, REQUEST_BUF_SIZE);
+    connection->request_start_us = time_us_64();
+  }
+
+  if (length == 0 || connection->state != ONLINE)
+    return true;
+  int status = ws_decode(&connection->decoder, data, length, handle_frame, connection);
+  if (status == WS_DECODE_OK)
+    return true;
+  if (status != WS_DECODE_STOPPED) {
+    ++counters.websocket_errors;
+    LOG_WARN("Received invalid websocket frame (%d).", status);
+    send_websocket_close_frame(connection, status);
+  }
+  *result = connection_close(connection);
+  return false;
+}
+
+static err_t recv_callback(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+  struct Connection *connection = arg;
+  if (!connection || connection->pcb != pcb) {
+    LOG_ERROR("PCBs not matching?");
+    if (p)
+      pbuf_free(p);
+    return ERR_OK;
+  }
+  if (!p) {
+    LOG_INFO("Connection closed.");
+    return connection_close(connection);
+  }
+
+  // Any data, including a PONG, shows that the peer is still there.
+  connection->last_activity_us = time_us_64();
+  connection->ping_outstanding = false;
+
+  // Acknowledged up front: closing a pcb with unacknowledged received data
+  // makes lwIP reset it, dropping the queued response.
+  tcp_recved(pcb, p->tot_len);
+  err_t result = ERR_OK;
+  bool open = true;
+  for (struct pbuf *q = p; q && open; q = q->next)
+    open = handle_segment(connection, q->payload, q->len, &result);
+  // Responses to all the requests in this burst go out together.
+  if (open)
+    tcp_output(pcb);
+  pbuf_free(p);
+  return result;
+}
+
+static err_t sent_callback(void *arg, struct tcp_pcb *pcb, u16_t length) {
+  struct Connection *connection = arg;
+  // lwIP has moved lastack past the acknowledged bytes by now.
+  if (connection && connection->reply_pending && (int32_t)(pcb->lastack - connection->reply_end_seq) >= 0) {
+    histogram_record(&latency.apply_acked, time_us_64() - connection->reply_start_us);
+    connection->reply_pending = false;
+  }
+  // Acknowledged data has made room for a state the client missed.
+  if (connection)
+    send_missed_state(connection);
+  return ERR_OK;
+}
+
+static void err_callback(void *arg, err_t err) {
+  LOG_WARN("Error code %d.", err);
+  // lwIP has already freed the pcb so only the slot is released.
+  struct Connection *connection = arg;
+  if (connection)
+    connection_release(connection);
+}
+
+static err_t poll_callback(void *arg, struct tcp_pcb *pcb) {
+  struct Connection *connection = arg;
+  if (!connection)
+    return ERR_OK;
+
+  uint64_t now = time_us_64();
+  if (connection->state == HANDSHAKE) {
+    // Measured from the start of the request so that trickling bytes cannot
+    // extend it. It also closes idle keep-alive connections.
+    if (now - connection->request_start_us >= HTTP_REQUEST_TIMEOUT_MS * 1000ull) {
+      LOG_WARN("HTTP request timed out (slot %u).", (unsigned)(connection - connections));
+      return connection_abort(connection);
+    }
+    return ERR_OK;
+  }
+
+  send_missed_state(connection);
+  if (connection->ping_outstanding) {
+    if (now - connection->ping_sent_us >= PONG_TIMEOUT_MS * 1000ull) {
+      LOG_WARN("Ping timed out (slot %u).", (unsigned)(connection - connections));
+      return connection_abort(connection);
+    }
+  } else if (now - connection->last_activity_us >= IDLE_PING_MS * 1000ull) {
+    send_websocket_frame(connection, WS_OP_PING, NULL, 0);
+    connection->ping_sent_us = now;
+    connection->ping_outstanding = true;
+  }
+  return ERR_OK;
+}
+
+err_t server_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+  if (pcb == NULL || err != ERR_OK)  {
+      ++counters.rejected;
+      LOG_WARN("Failure in accept.");
+      return ERR_VAL;
+  }
+  struct Connection *connection = connection_alloc(pcb);
+  if (!connection) {
+    ++counters.rejected;
+    LOG_WARN("Connection table full.");
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  ++counters.accepted;
+  LOG_INFO("Client connected (slot %u).", (unsigned)(connection - connections));
+  if (!boot_timeline_get(BOOT_FIRST_CLIENT))
+    boot_timeline_mark(BOOT_FIRST_CLIENT);
+  tcp_recv(pcb, recv_callback);
+  tcp_err(pcb, err_callback);
+  tcp_sent(pcb, sent_callback);
+  tcp_poll(pcb, poll_callback, POLL_INTERVAL);
+  return ERR_OK;
+}
+
+void server_restore_state(const struct CommandState *state) {
+  led_on = state->on;
+  led_brightness = state->level;
+  led_effect = (struct LightingEffect){
+    .mode = state->mode,
+    .duty = state->duty,
+    .phase = state->phase,
+    .period_ms = state->period_ms,
+  };
+  if (led_effect.mode != LIGHTING_STEADY)
+    lighting_set_effect(&led_effect);
+  lighting_set_level(led_level(), 0);
+}
+
+void server_init(uint32_t epoch) {
+  struct CommandState state = current_state();
+  state_log_init(&state_log, epoch, &state);
+}
+
+const struct StateLog *server_state_log(void) {
+  return &state_log;
+}
+
+void server_print_latency(void) {
+  histogram_print(&latency.recv_decode, "recv to decode");
+  histogram_print(&latency.decode_apply, "decode to lighting");
+  histogram_print(lighting_output_latency(), "lighting to output");
+  histogram_print(&latency.apply_output, "lighting to tcp_output");
+  histogram_print(&latency.apply_acked, "lighting to TCP ack");
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/tcp.h"
+
+#include "command.h"
+#include "metrics.h"
+#include "state_log.h"
+
+// The protocol and state core of the server: the REST endpoints and the
+// WebSocket protocol on the lwIP raw TCP API, and the LED state with its
+// versioned log. It reaches the hardware only through the lighting engine,
+// the interrupt lock and the clock, so the same code runs on the board, where
+// main.c brings up the radio, storage and button around it, and on the host
+// against the stand-ins in bench/ (see bench/sim_server.c).
+//
+// The functions below are called from the main loop unless noted.
+
+// Brings the LED to a state saved before a reset. Call before server_init.
+void server_restore_state(const struct CommandState *state);
+
+// Starts the state log in the given epoch with the current state as its
+// first version.
+void server_init(uint32_t epoch);
+
+// The accept callback for the listening pcb.
+err_t server_accept(void *arg, struct tcp_pcb *pcb, err_t err);
+
+// Gives the current state the next version, if it changed, and sends it to
+// every client.
+void server_send_state(void);
+
+// Switches the LED on or off without publishing the change, which is left to
+// server_send_state. May be called from interrupt context.
+void server_toggle_led(void);
+
+// Sets a level streamed over DMX. A changed level is published, but not more
+// often than a few times a second.
+void server_stream_level(uint16_t level);
+
+const struct StateLog *server_state_log(void);
+
+// Prints the latency histograms of the stages of a WebSocket request.
+void server_print_latency(void);
+
+// Provided by the platform layer: adds its own samples to /metrics after those
+// of the server.
+void server_add_platform_metrics(struct Metrics *metrics);
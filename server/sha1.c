@@ -0,0 +1,99 @@
+#include <string.h>
+
+#include "sha1.h"
+
+static uint32_t rotl(uint32_t x, unsigned n) {
+  return x << n | x >> (32 - n);
+}
+
+static uint32_t load_be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void store_be32(uint8_t *p, uint32_t x) {
+  p[0] = x >> 24;
+  p[1] = x >> 16;
+  p[2] = x >> 8;
+  p[3] = x;
+}
+
+static void compress(uint32_t state[5], const uint8_t block[64]) {
+  // The schedule is expanded in place, 16 words at a time.
+  uint32_t w[16];
+  for (size_t i = 0; i < 16; ++i)
+    w[i] = load_be32(&block[4 * i]);
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  for (size_t i = 0; i < 80; ++i) {
+    if (i >= 16)
+      w[i & 15] = rotl(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+    uint32_t f, k;
+    if (i < 20) {
+      f = d ^ (b & (c ^ d));
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (d & (b | c));
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    uint32_t t = rotl(a, 5) + f + e + k + w[i & 15];
+    e = d;
+    d = c;
+    c = rotl(b, 30);
+    b = a;
+    a = t;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void sha1_init(struct Sha1 *sha1) {
+  sha1->state[0] = 0x67452301;
+  sha1->state[1] = 0xEFCDAB89;
+  sha1->state[2] = 0x98BADCFE;
+  sha1->state[3] = 0x10325476;
+  sha1->state[4] = 0xC3D2E1F0;
+  sha1->length = 0;
+}
+
+void sha1_update(struct Sha1 *sha1, const void *data, size_t length) {
+  const uint8_t *p = data;
+  size_t used = sha1->length & 63;
+  sha1->length += length;
+  while (length > 0) {
+    size_t n = 64 - used < length ? 64 - used : length;
+    memcpy(&sha1->block[used], p, n);
+    used += n;
+    p += n;
+    length -= n;
+    if (used == 64) {
+      compress(sha1->state, sha1->block);
+      used = 0;
+    }
+  }
+}
+
+void sha1_final(struct Sha1 *sha1, uint8_t digest[SHA1_SIZE]) {
+  uint64_t bits = sha1->length * 8;
+  size_t used = sha1->length & 63;
+  sha1->block[used++] = 0x80;
+  if (used > 56) {
+    memset(&sha1->block[used], 0, 64 - used);
+    compress(sha1->state, sha1->block);
+    used = 0;
+  }
+  memset(&sha1->block[used], 0, 56 - used);
+  store_be32(&sha1->block[56], bits >> 32);
+  store_be32(&sha1->block[60], bits);
+  compress(sha1->state, sha1->block);
+  for (size_t i = 0; i < 5; ++i)
+    store_be32(&digest[4 * i], sha1->state[i]);
+}
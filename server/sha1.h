@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact SHA-1, used only for the WebSocket handshake. Written for size on
+// the Cortex-M0+: a single round loop over a 16 word message schedule.
+
+#define SHA1_SIZE 20
+
+struct Sha1 {
+  uint32_t state[5];
+  uint64_t length;
+  uint8_t block[64];
+};
+
+void sha1_init(struct Sha1 *sha1);
+void sha1_update(struct Sha1 *sha1, const void *data, size_t length);
+void sha1_final(struct Sha1 *sha1, uint8_t digest[SHA1_SIZE]);
@@ -0,0 +1,34 @@
+#include "state_log.h"
+
+_Static_assert((STATE_LOG_SIZE & (STATE_LOG_SIZE - 1)) == 0, "STATE_LOG_SIZE must be a power of two");
+
+static bool state_equal(const struct CommandState *a, const struct CommandState *b) {
+  return a->on == b->on && a->level == b->level && a->mode == b->mode && a->period_ms == b->period_ms
+         && a->duty == b->duty && a->phase == b->phase;
+}
+
+void state_log_init(struct StateLog *log, uint32_t epoch, const struct CommandState *state) {
+  log->epoch = epoch;
+  log->version = 1;
+  log->entries[1 % STATE_LOG_SIZE] = *state;
+  log->entries[1 % STATE_LOG_SIZE].version = 1;
+}
+
+bool state_log_record(struct StateLog *log, const struct CommandState *state) {
+  if (state_equal(state, state_log_latest(log)))
+    return false;
+  // A power of two size keeps the slots in order when the version wraps.
+  struct CommandState *entry = &log->entries[++log->version % STATE_LOG_SIZE];
+  *entry = *state;
+  entry->version = log->version;
+  return true;
+}
+
+bool state_log_since(const struct StateLog *log, uint32_t epoch, uint32_t version, uint32_t *first) {
+  // The history holds the latest STATE_LOG_SIZE versions. A version ahead of
+  // the latest one wraps around to a large difference.
+  if (epoch != log->epoch || log->version - version >= STATE_LOG_SIZE)
+    return false;
+  *first = version + 1;
+  return true;
+}
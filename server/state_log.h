@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "command.h"
+
+// Versioned history of the LED state. Every published change gets the next
+// version, whether it came from the button, a WebSocket command or a REST
+// request, so all clients see the changes in the same order. A client that
+// reconnects with the epoch and version it saw last is sent only the states
+// after that version while they are still in the history, and a snapshot of
+// the current state otherwise. The epoch is chosen at boot, so versions from
+// before a restart never match.
+
+// Must be a power of two.
+#define STATE_LOG_SIZE 16
+
+struct StateLog {
+  uint32_t epoch;
+  // Latest version; its state is in entries[version % STATE_LOG_SIZE].
+  uint32_t version;
+  struct CommandState entries[STATE_LOG_SIZE];
+};
+
+// Starts the history with the initial state as version 1.
+void state_log_init(struct StateLog *log, uint32_t epoch, const struct CommandState *state);
+
+// Records the state as the next version unless it equals the latest one.
+// Returns whether it was recorded.
+bool state_log_record(struct StateLog *log, const struct CommandState *state);
+
+static inline const struct CommandState *state_log_get(const struct StateLog *log, uint32_t version) {
+  return &log->entries[version % STATE_LOG_SIZE];
+}
+
+static inline const struct CommandState *state_log_latest(const struct StateLog *log) {
+  return state_log_get(log, log->version);
+}
+
+// Sets first to the oldest version missed by a client that last saw the given
+// epoch and version; first is past the latest version if it missed nothing.
+// Returns false if the client needs a snapshot instead: the epoch differs, or
+// the version was never issued or has dropped out of the history.
+bool state_log_since(const struct StateLog *log, uint32_t epoch, uint32_t version, uint32_t *first);
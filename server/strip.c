@@ -0,0 +1,106 @@
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+
+#include "strip.h"
+#include "ws2812.pio.h"
+
+#define STRIP_FREQ 800000
+// The state machine still shifts out the joined FIFO after the DMA transfer
+// completes, then the line has to stay low for the reset time.
+#define STRIP_LATCH_US (8 * 40 + 80)
+
+static struct {
+  PIO pio;
+  uint sm;
+  int dma_channel;
+  alarm_pool_t *alarm_pool;
+  size_t pixel_count;
+  enum StripFormat format;
+  uint32_t buffers[2][STRIP_PIXELS > 0 ? STRIP_PIXELS : 1];
+  // Buffer being sent or latched, buffer waiting for it, and buffer open for
+  // writing; -1 when there is none.
+  volatile int active;
+  volatile int queued;
+  volatile int back;
+} strip;
+
+static void __not_in_flash_func(start_transfer)(int index) {
+  strip.active = index;
+  dma_channel_set_read_addr(strip.dma_channel, strip.buffers[index], false);
+  dma_channel_set_trans_count(strip.dma_channel, strip.pixel_count, true);
+}
+
+static int64_t __not_in_flash_func(latch_done)(alarm_id_t id, void *user_data) {
+  int finished = strip.active;
+  strip.active = -1;
+  if (strip.queued >= 0) {
+    start_transfer(strip.queued);
+    strip.queued = -1;
+    strip.back = finished;
+  }
+  return 0;
+}
+
+static void __not_in_flash_func(dma_complete)(void) {
+  if (!dma_channel_get_irq1_status(strip.dma_channel))
+    return;
+  dma_channel_acknowledge_irq1(strip.dma_channel);
+  alarm_pool_add_alarm_in_us(strip.alarm_pool, STRIP_LATCH_US, latch_done, NULL, true);
+}
+
+void strip_init(unsigned int pin, size_t pixel_count, enum StripFormat format, alarm_pool_t *alarm_pool) {
+  strip.pio = pio0;
+  strip.sm = pio_claim_unused_sm(strip.pio, true);
+  strip.alarm_pool = alarm_pool;
+  strip.pixel_count = pixel_count < STRIP_PIXELS ? pixel_count : STRIP_PIXELS;
+  strip.format = format;
+  strip.active = -1;
+  strip.queued = -1;
+  strip.back = 0;
+
+  uint offset = pio_add_program(strip.pio, &ws2812_program);
+  ws2812_program_init(strip.pio, strip.sm, offset, pin, STRIP_FREQ, format == STRIP_GRBW);
+
+  strip.dma_channel = dma_claim_unused_channel(true);
+  dma_channel_config config = dma_channel_get_default_config(strip.dma_channel);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+  channel_config_set_read_increment(&config, true);
+  channel_config_set_write_increment(&config, false);
+  channel_config_set_dreq(&config, pio_get_dreq(strip.pio, strip.sm, true));
+  dma_channel_configure(strip.dma_channel, &config, &strip.pio->txf[strip.sm], NULL, 0, false);
+
+  // DMA_IRQ_1 is enabled on the calling core.
+  dma_channel_set_irq1_enabled(strip.dma_channel, true);
+  irq_add_shared_handler(DMA_IRQ_1, dma_complete, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+}
+
+size_t strip_pixel_count(void) {
+  return strip.pixel_count;
+}
+
+enum StripFormat strip_format(void) {
+  return strip.format;
+}
+
+uint32_t *strip_back_buffer(void) {
+  int back = strip.back;
+  return back >= 0 ? strip.buffers[back] : NULL;
+}
+
+void strip_show(void) {
+  uint32_t interrupts = save_and_disable_interrupts();
+  int index = strip.back;
+  if (index >= 0) {
+    if (strip.active < 0) {
+      start_transfer(index);
+      strip.back = index ^ 1;
+    } else {
+      strip.queued = index;
+      strip.back = -1;
+    }
+  }
+  restore_interrupts(interrupts);
+}
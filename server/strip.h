@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pico/time.h"
+
+#include "strip_encode.h"
+
+// Addressable LED strip driven by a PIO state machine fed by DMA. Frames are
+// double buffered: the caller encodes into the back buffer while the front
+// buffer is shifted out, and strip_show swaps them only once the previous
+// frame has been latched, so a frame is never torn. Must be used from a
+// single core, which also takes the DMA and latch interrupts.
+
+#define STRIP_MAX_PIXELS 1000
+
+// The pixels of the strip, configured from CMake. The buffers are sized for
+// it at compile time, so a build without a strip reserves no room for one.
+#ifndef STRIP_PIXELS
+#define STRIP_PIXELS 0
+#endif
+
+// Claims a state machine and DMA channel. The latch delay is timed with an
+// alarm from alarm_pool. pixel_count is limited to STRIP_PIXELS.
+void strip_init(unsigned int pin, size_t pixel_count, enum StripFormat format, alarm_pool_t *alarm_pool);
+
+size_t strip_pixel_count(void);
+enum StripFormat strip_format(void);
+
+// Returns the buffer to encode the next frame into, or NULL while both
+// buffers are in use, in which case the caller should retry after the current
+// frame has gone out.
+uint32_t *strip_back_buffer(void);
+
+// Queues the back buffer for output. Does not block.
+void strip_show(void);
@@ -0,0 +1,25 @@
+#include "gamma_table.h"
+#include "strip_encode.h"
+
+static inline uint8_t scale(uint8_t value, uint8_t brightness) {
+  return gamma8_table[(value * (brightness + 1)) >> 8];
+}
+
+void strip_encode(uint32_t *words, const struct Pixel *pixels, size_t count, enum StripFormat format, uint8_t brightness) {
+  if (format == STRIP_GRBW) {
+    for (size_t i = 0; i < count; ++i) {
+      const struct Pixel *p = &pixels[i];
+      words[i] = (uint32_t)scale(p->g, brightness) << 24
+               | (uint32_t)scale(p->r, brightness) << 16
+               | (uint32_t)scale(p->b, brightness) << 8
+               | scale(p->w, brightness);
+    }
+  } else {
+    for (size_t i = 0; i < count; ++i) {
+      const struct Pixel *p = &pixels[i];
+      words[i] = (uint32_t)scale(p->g, brightness) << 24
+               | (uint32_t)scale(p->r, brightness) << 16
+               | (uint32_t)scale(p->b, brightness) << 8;
+    }
+  }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Conversion of pixels to the words the WS2812 PIO program shifts out. Kept
+// free of hardware access so that it can be built and measured on the host.
+
+enum StripFormat {
+  // WS2812/WS2812B: 24 bits per pixel, green first.
+  STRIP_GRB,
+  // SK6812 RGBW: 32 bits per pixel, green first.
+  STRIP_GRBW,
+};
+
+struct Pixel {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t w;
+};
+
+// Encodes count pixels, scaled by an 8-bit brightness and gamma corrected,
+// into words for the PIO TX FIFO. The bits are left aligned as the program
+// shifts out the most significant bit first.
+void strip_encode(uint32_t *words, const struct Pixel *pixels, size_t count, enum StripFormat format, uint8_t brightness);
@@ -0,0 +1,288 @@
+#!/usr/bin/env python3
+"""Reports the flash and RAM footprint of the firmware per module and checks it
+against a budget.
+
+Flash, .data and .bss are attributed to modules from the input sections in the
+linker map. Stack is the largest single frame of each module, from the .su
+files GCC writes with -fstack-usage. The ELF provides the section sizes, the
+stacks reserved for both cores and the RAM left over for the heap, which lwIP
+allocates from with MEM_LIBC_MALLOC.
+
+A budget written with --write-budget records the build it was measured on, as
+given by --build, and sets each limit that much headroom above the measured
+figure. A budget is only checked against a build of the same kind.
+
+Exits with status 1 if any figure is over its budget.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+# First match wins, so more specific patterns come first.
+MODULES = [
+    ("lwip", re.compile(r"/lwip/")),
+    ("cyw43", re.compile(r"cyw43")),
+    ("mbedtls", re.compile(r"mbedtls|mbedcrypto")),
+    ("stdio", re.compile(r"pico_stdio|pico_printf|tinyusb")),
+    ("app", re.compile(r"smart-led-server\.dir/[^/]+\.obj$|smart-led-server\.dir/[^/]+\.c\.o$")),
+    ("sdk", re.compile(r"pico-sdk|/src/rp2_common/|/src/common/|/src/rp2040/")),
+    ("libc", re.compile(r"\.a\(|libgcc|libc|libm")),
+]
+OTHER = "other"
+COLUMNS = ["flash", "data", "bss", "stack"]
+
+FLASH_SECTIONS = {".boot2", ".text", ".rodata", ".ARM.extab", ".ARM.exidx", ".binary_info"}
+# Initialised RAM, whose initial values are stored in flash as well.
+DATA_SECTIONS = {".data", ".scratch_x", ".scratch_y"}
+BSS_SECTIONS = {".bss", ".uninitialized_data", ".ram_vector_table"}
+
+# Stack reservations and the symbols bounding the heap in the Pico SDK linker
+# scripts.
+STACK_SECTIONS = {".stack_dummy": "core 0 stack", ".stack1_dummy": "core 1 stack"}
+HEAP_START = "__end__"
+HEAP_END = "__HeapLimit"
+
+INPUT_SECTION = re.compile(r"^ (\S+)(?:\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(.+))?$")
+CONTINUATION = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(.+)$")
+OUTPUT_SECTION = re.compile(r"^(\.\S+)(?:\s+0x[0-9a-fA-F]+\s+0x[0-9a-fA-F]+.*)?$")
+
+
+def classify(path):
+    path = path.replace("\\", "/")
+    for name, pattern in MODULES:
+        if pattern.search(path):
+            return name
+    return OTHER
+
+
+def parse_map(path):
+    """Returns {module: {"flash", "data", "bss"}} from the input sections."""
+    usage = {}
+    in_memory_map = False
+    output_section = None
+    pending = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if line.startswith("Linker script and memory map"):
+                in_memory_map = True
+                continue
+            if not in_memory_map:
+                continue
+
+            match = OUTPUT_SECTION.match(line)
+            if match:
+                output_section = match.group(1)
+                pending = None
+                continue
+
+            if pending:
+                match = CONTINUATION.match(line)
+                pending_name, pending = pending, None
+                if match:
+                    add_input(usage, output_section, pending_name, int(match.group(2), 16), match.group(3))
+                    continue
+
+            match = INPUT_SECTION.match(line)
+            if not match or match.group(1).startswith("*"):
+                continue
+            if match.group(2) is None:
+                # Long section names put the address and size on the next line.
+                pending = match.group(1)
+                continue
+            add_input(usage, output_section, match.group(1), int(match.group(3), 16), match.group(4))
+    return usage
+
+
+def add_input(usage, output_section, input_section, size, path):
+    if size == 0 or output_section is None:
+        return
+    if output_section in FLASH_SECTIONS:
+        columns = ["flash"]
+    elif output_section in DATA_SECTIONS:
+        columns = ["flash", "data"]
+    elif output_section in BSS_SECTIONS:
+        columns = ["bss"]
+    else:
+        return
+    module = usage.setdefault(classify(path.strip()), dict.fromkeys(COLUMNS, 0))
+    for column in columns:
+        module[column] += size
+
+
+def parse_stack_usage(build_dir, usage):
+    """Adds the largest frame of each module from the .su files."""
+    for root, _, files in os.walk(build_dir):
+        for name in files:
+            if not name.endswith(".su"):
+                continue
+            path = os.path.join(root, name)
+            module = usage.setdefault(classify(path[: -len(".su")] + ".obj"), dict.fromkeys(COLUMNS, 0))
+            with open(path, errors="replace") as f:
+                for line in f:
+                    fields = line.rsplit(None, 2)
+                    if len(fields) == 3 and fields[1].isdigit():
+                        module["stack"] = max(module["stack"], int(fields[1]))
+
+
+def parse_elf(path):
+    """Returns the section sizes and symbol values of a little-endian ELF."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[5] != 1:
+        sys.exit(f"{path}: not a little-endian ELF file")
+    elf64 = data[4] == 2
+    if elf64:
+        shoff, = struct.unpack_from("<Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x3A)
+        section_format, symbol_format, symbol_size = "<IIQQQQIIQQ", "<IBBHQQ", 24
+    else:
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+        section_format, symbol_format, symbol_size = "<IIIIIIIIII", "<IIIBBH", 16
+
+    headers = [struct.unpack_from(section_format, data, shoff + i * shentsize) for i in range(shnum)]
+
+    def string(table, offset):
+        start = headers[table][4] + offset
+        return data[start:data.index(b"\0", start)].decode()
+
+    sections = {}
+    symbols = {}
+    for header in headers:
+        name = string(shstrndx, header[0])
+        sections[name] = header[5]
+        if header[1] != 2:  # SHT_SYMTAB
+            continue
+        for offset in range(header[4], header[4] + header[5], symbol_size):
+            fields = struct.unpack_from(symbol_format, data, offset)
+            value = fields[4] if elf64 else fields[1]
+            symbol_name = string(header[6], fields[0])
+            if symbol_name:
+                symbols[symbol_name] = value
+    return sections, symbols
+
+
+def read_budget(path):
+    budget = {}
+    if not os.path.exists(path):
+        sys.exit(f"{path}: no budget for this build, write one with the footprint-budget target")
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].split()
+            if not line:
+                continue
+            if line[0] == "build" and len(line) > 1:
+                budget["build"] = " ".join(line[1:])
+            elif line[0] == "heap_min" and len(line) == 2:
+                budget["heap_min"] = int(line[1])
+            elif len(line) == 1 + len(COLUMNS):
+                budget[line[0]] = dict(zip(COLUMNS, map(int, line[1:])))
+            else:
+                sys.exit(f"{path}:{number}: expected a module and {len(COLUMNS)} limits")
+    return budget
+
+
+def write_budget(path, usage, totals, heap, headroom, build):
+    def limit(value):
+        return int(value * (1 + headroom / 100) + 0.5)
+
+    lines = [
+        "# Footprint budget in bytes, checked by the footprint target with",
+        "# tools/footprint.py. Regenerate with the footprint-budget target after a",
+        "# deliberate increase, and review the diff.",
+        "#",
+        f"# Each limit is the figure measured on the build below plus {headroom:g}%,",
+        f"# and heap_min the measured heap less {headroom:g}%.",
+    ]
+    if build:
+        lines.append(f"build {build}")
+    lines += [
+        "",
+        "# stack is the largest single stack frame within the module.",
+        "# " + " ".join(f"{c:>8}" for c in ["module"] + COLUMNS),
+    ]
+    for module in sorted(usage):
+        lines.append("  " + " ".join(f"{x:>8}" for x in [module] + [limit(usage[module][c]) for c in COLUMNS]))
+    lines.append("  " + " ".join(f"{x:>8}" for x in ["total"] + [limit(totals[c]) for c in COLUMNS]))
+    if heap is not None:
+        lines += [
+            "",
+            "# RAM that must remain for the heap, from which lwIP allocates.",
+            f"heap_min {int(heap / (1 + headroom / 100))}",
+        ]
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--map", required=True, help="linker map file")
+    parser.add_argument("--elf", required=True, help="linked ELF file")
+    parser.add_argument("--build-dir", help="directory searched for .su files")
+    parser.add_argument("--budget", help="budget file to check against")
+    parser.add_argument("--write-budget", help="write a budget with headroom over the current figures")
+    parser.add_argument("--headroom", type=float, default=10, help="percent headroom for --write-budget")
+    parser.add_argument("--build", help="the board and build type, recorded in a budget and checked against it")
+    args = parser.parse_args()
+
+    usage = parse_map(args.map)
+    if args.build_dir:
+        parse_stack_usage(args.build_dir, usage)
+    sections, symbols = parse_elf(args.elf)
+
+    totals = dict.fromkeys(COLUMNS, 0)
+    print(f"{'module':<10}" + "".join(f"{c:>10}" for c in COLUMNS))
+    for module in sorted(usage, key=lambda m: -usage[m]["flash"]):
+        print(f"{module:<10}" + "".join(f"{usage[module][c]:>10}" for c in COLUMNS))
+        for column in COLUMNS:
+            totals[column] = max(totals[column], usage[module][column]) if column == "stack" else totals[column] + usage[module][column]
+    print(f"{'total':<10}" + "".join(f"{totals[c]:>10}" for c in COLUMNS))
+
+    print()
+    for section, name in STACK_SECTIONS.items():
+        if section in sections:
+            print(f"{name}: {sections[section]} bytes reserved")
+    heap = None
+    if HEAP_START in symbols and HEAP_END in symbols:
+        heap = symbols[HEAP_END] - symbols[HEAP_START]
+        print(f"heap: {heap} bytes")
+
+    if args.write_budget:
+        write_budget(args.write_budget, usage, totals, heap, args.headroom, args.build)
+        print(f"Wrote {args.write_budget}.")
+        return 0
+
+    if not args.budget:
+        return 0
+    budget = read_budget(args.budget)
+    failures = []
+    if "build" not in budget:
+        print(f"{args.budget} was not measured on a build, its limits are estimates.")
+    elif args.build and budget["build"] != args.build:
+        failures.append(f"budget measured on a {budget['build']} build, this is {args.build}")
+    for module, figures in list(usage.items()) + [("total", totals)]:
+        limits = budget.get(module)
+        if limits is None:
+            failures.append(f"{module}: no budget")
+            continue
+        for column in COLUMNS:
+            if figures[column] > limits[column]:
+                failures.append(f"{module} {column}: {figures[column]} > {limits[column]}")
+    if "heap_min" in budget and heap is not None and heap < budget["heap_min"]:
+        failures.append(f"heap: {heap} < {budget['heap_min']}")
+
+    print()
+    if failures:
+        for failure in failures:
+            print(f"Over budget: {failure}")
+        return 1
+    print(f"Within budget ({args.budget}).")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
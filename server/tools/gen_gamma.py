@@ -0,0 +1,46 @@
+#!/usr/bin/env python3
+"""Generates the gamma lookup tables used by the lighting engine.
+
+gamma_table maps a perceptual brightness (the top 8 bits of a 16-bit level,
+plus one extra entry for interpolation) to a linear 16-bit PWM level.
+gamma8_table maps 8-bit pixel components for the LED strip.
+"""
+
+import argparse
+
+GAMMA = 2.2
+ENTRIES = 257
+ENTRIES8 = 256
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("output")
+    parser.add_argument("--gamma", type=float, default=GAMMA)
+    args = parser.parse_args()
+
+    values = [round(65535 * (i / (ENTRIES - 1)) ** args.gamma) for i in range(ENTRIES)]
+    values8 = [round(255 * (i / (ENTRIES8 - 1)) ** args.gamma) for i in range(ENTRIES8)]
+    lines = [
+        "// Generated by tools/gen_gamma.py, do not edit.",
+        "#pragma once",
+        "",
+        "#include <stdint.h>",
+        "",
+        f"#define GAMMA_TABLE_SIZE {ENTRIES}",
+        "",
+        "static const uint16_t gamma_table[GAMMA_TABLE_SIZE] = {",
+    ]
+    for i in range(0, ENTRIES, 8):
+        lines.append("  " + " ".join(f"{v:5d}," for v in values[i:i + 8]))
+    lines += ["};", "", "static const uint8_t gamma8_table[256] = {"]
+    for i in range(0, ENTRIES8, 16):
+        lines.append("  " + " ".join(f"{v:3d}," for v in values8[i:i + 16]))
+    lines += ["};", ""]
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(lines))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Decodes the deferred log of the firmware back into text.
+
+The firmware prints log records as lines of hex words:
+
+    @@ <level> <time us> <format address> <arguments>...
+
+The format strings, and the strings passed for %s, are read from the ELF the
+firmware was built from, so it must be the same build. Other lines are passed
+through unchanged. Reads the serial output from a file or standard input, e.g.
+
+    tools/log_decode.py build/smart-led-server.elf < /dev/ttyACM0
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+LEVELS = ["DEBUG", "INFO", "WARN", "ERROR"]
+RECORD = re.compile(r"^@@ ([0-9a-f]) ([0-9a-f]{8}) ([0-9a-f]{8})((?: [0-9a-f]{8})*)\s*$")
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t)?([diouxXcsp%])")
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+
+class Image:
+    """The loaded sections of a little-endian ELF, by address."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[5] != 1:
+            sys.exit(f"{path}: not a little-endian ELF file")
+        if data[4] == 2:
+            shoff, = struct.unpack_from("<Q", data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", data, 0x3A)
+            section_format = "<IIQQQQIIQQ"
+        else:
+            shoff, = struct.unpack_from("<I", data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+            section_format = "<IIIIIIIIII"
+        self.sections = []
+        for i in range(shnum):
+            _, kind, flags, address, offset, size = struct.unpack_from(section_format, data, shoff + i * shentsize)[:6]
+            if flags & SHF_ALLOC and kind != SHT_NOBITS and size:
+                self.sections.append((address, data[offset:offset + size]))
+
+    def string(self, address):
+        for start, contents in self.sections:
+            if start <= address < start + len(contents):
+                end = contents.find(b"\0", address - start)
+                return contents[address - start:end if end >= 0 else None].decode(errors="replace")
+        return f"<bad string 0x{address:08x}>"
+
+
+def format_record(image, format_string, words):
+    """Formats the arguments like printf, 32-bit words as the firmware passes them."""
+    words = iter(words)
+
+    def next_word():
+        return next(words, 0)
+
+    def convert(match):
+        flags, width, precision, _, kind = match.groups()
+        if kind == "%":
+            return "%"
+        if width == "*":
+            width = str(next_word())
+        if precision == "*":
+            precision = str(next_word())
+        spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+        value = next_word()
+        if kind in "di":
+            return (spec + "d") % (value - (1 << 32) if value & 0x80000000 else value)
+        if kind == "u":
+            return (spec + "d") % value
+        if kind in "oxX":
+            return (spec + kind) % value
+        if kind == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if kind == "p":
+            return (spec + "s") % f"0x{value:08x}"
+        return (spec + "s") % image.string(value)
+
+    return CONVERSION.sub(convert, format_string)
+
+
+def decode(image, line):
+    match = RECORD.match(line)
+    if not match:
+        return line.rstrip("\r\n")
+    level, time_us, address = int(match[1], 16), int(match[2], 16), int(match[3], 16)
+    words = [int(word, 16) for word in match[4].split()]
+    text = format_record(image, image.string(address), words)
+    name = LEVELS[level] if level < len(LEVELS) else str(level)
+    return f"[{time_us / 1e6:11.6f}] {name:5} {text}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="ELF file of the running firmware")
+    parser.add_argument("input", nargs="?", help="serial output to decode (default: standard input)")
+    args = parser.parse_args()
+
+    image = Image(args.elf)
+    source = open(args.input, errors="replace") if args.input else sys.stdin
+    with source:
+        for line in source:
+            print(decode(image, line), flush=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,264 @@
+#include <string.h>
+
+#if WS_MBEDTLS
+#include <mbedtls/base64.h>
+#include <mbedtls/sha1.h>
+#else
+#include "base64.h"
+#include "sha1.h"
+#endif
+
+#include "ws.h"
+
+void ws_decoder_init(struct WsDecoder *decoder, unsigned char *message_buf, size_t message_capacity) {
+  memset(decoder, 0, sizeof(*decoder));
+  decoder->state = WS_STATE_HEADER;
+  decoder->header_needed = 2;
+  decoder->message_buf = message_buf;
+  decoder->message_capacity = message_capacity;
+}
+
+static void reset_header(struct WsDecoder *decoder) {
+  decoder->state = WS_STATE_HEADER;
+  decoder->header_length = 0;
+  decoder->header_needed = 2;
+}
+
+// Validates the first two header bytes and works out the full header length.
+static int parse_base_header(struct WsDecoder *decoder, const unsigned char *h) {
+  unsigned char b0 = h[0], b1 = h[1];
+  decoder->fin = b0 & WS_FIN;
+  decoder->opcode = b0 & WS_OPCODE;
+
+  // No extensions are negotiated so the reserved bits must be clear, and
+  // every client frame must be masked.
+  if ((b0 & WS_RSV) || !(b1 & WS_MASK))
+    return WS_CLOSE_PROTOCOL_ERROR;
+
+  unsigned char length = b1 & WS_PAYLOAD_LEN;
+  if (decoder->opcode & WS_CONTROL) {
+    if (decoder->opcode > WS_OP_PONG || !decoder->fin || length > WS_MAX_CONTROL_PAYLOAD)
+      return WS_CLOSE_PROTOCOL_ERROR;
+  } else if (decoder->opcode == WS_OP_CONTINUATION) {
+    if (!decoder->message_opcode)
+      return WS_CLOSE_PROTOCOL_ERROR;
+  } else if (decoder->opcode == WS_OP_TEXT || decoder->opcode == WS_OP_BINARY) {
+    if (decoder->message_opcode)
+      return WS_CLOSE_PROTOCOL_ERROR;
+  } else {
+    return WS_CLOSE_PROTOCOL_ERROR;
+  }
+
+  if (length == WS_PAYLOAD_LEN_16)
+    decoder->header_needed = 2 + 2 + 4;
+  else if (length == WS_PAYLOAD_LEN_64)
+    decoder->header_needed = 2 + 8 + 4;
+  else
+    decoder->header_needed = 2 + 4;
+  return WS_DECODE_OK;
+}
+
+// Parses the payload length and masking key once the full header is in.
+static int parse_extended_header(struct WsDecoder *decoder, const unsigned char *h) {
+  unsigned char length = h[1] & WS_PAYLOAD_LEN;
+  const unsigned char *mask;
+
+  if (length == WS_PAYLOAD_LEN_16) {
+    decoder->payload_length = (uint64_t)h[2] << 8 | h[3];
+    mask = &h[4];
+  } else if (length == WS_PAYLOAD_LEN_64) {
+    // The most significant bit must be zero.
+    if (h[2] & 0x80)
+      return WS_CLOSE_PROTOCOL_ERROR;
+    decoder->payload_length = 0;
+    for (size_t i = 2; i < 10; ++i)
+      decoder->payload_length = decoder->payload_length << 8 | h[i];
+    mask = &h[10];
+  } else {
+    decoder->payload_length = length;
+    mask = &h[2];
+  }
+  memcpy(decoder->mask, mask, 4);
+  decoder->payload_received = 0;
+  return WS_DECODE_OK;
+}
+
+void ws_unmask(unsigned char *dst, const unsigned char *src, size_t length, const unsigned char mask[4], uint64_t offset) {
+  size_t i = 0;
+
+  // The Cortex-M0+ has no unaligned word access, so words are only used when
+  // source and destination share their alignment, which is always the case
+  // when unmasking in place.
+  if ((((uintptr_t)dst ^ (uintptr_t)src) & 3) == 0) {
+    for (; i < length && ((uintptr_t)&dst[i] & 3); ++i)
+      dst[i] = src[i] ^ mask[(offset + i) & 3];
+
+    size_t k = offset + i;
+    uint32_t mask32 = (uint32_t)mask[k & 3]
+                    | (uint32_t)mask[(k + 1) & 3] << 8
+                    | (uint32_t)mask[(k + 2) & 3] << 16
+                    | (uint32_t)mask[(k + 3) & 3] << 24;
+    for (; i + 4 <= length; i += 4)
+      *(uint32_t *)&dst[i] = *(const uint32_t *)&src[i] ^ mask32;
+  }
+
+  for (; i < length; ++i)
+    dst[i] = src[i] ^ mask[(offset + i) & 3];
+}
+
+static unsigned char *payload_destination(struct WsDecoder *decoder) {
+  if (decoder->opcode & WS_CONTROL)
+    return decoder->control_buf;
+  return &decoder->message_buf[decoder->message_length];
+}
+
+static int complete_frame(struct WsDecoder *decoder, unsigned char *payload, ws_frame_handler handler, void *arg) {
+  unsigned char opcode = decoder->opcode;
+  size_t length = decoder->payload_length;
+  bool unfragmented = decoder->fin && opcode != WS_OP_CONTINUATION;
+  reset_header(decoder);
+
+  if (opcode & WS_CONTROL || (unfragmented && payload))
+    return handler(arg, opcode, payload, length) ? WS_DECODE_OK : WS_DECODE_STOPPED;
+
+  if (opcode != WS_OP_CONTINUATION)
+    decoder->message_opcode = opcode;
+  decoder->message_length += length;
+  if (!decoder->fin)
+    return WS_DECODE_OK;
+
+  unsigned char message_opcode = decoder->message_opcode;
+  size_t message_length = decoder->message_length;
+  decoder->message_opcode = 0;
+  decoder->message_length = 0;
+  return handler(arg, message_opcode, decoder->message_buf, message_length) ? WS_DECODE_OK : WS_DECODE_STOPPED;
+}
+
+int ws_decode(struct WsDecoder *decoder, unsigned char *data, size_t length, ws_frame_handler handler, void *arg) {
+  unsigned char *end = data + length;
+  int status;
+
+  while (data < end || (decoder->state == WS_STATE_PAYLOAD && decoder->payload_length == 0)) {
+    size_t available = end - data;
+
+    if (decoder->state == WS_STATE_HEADER) {
+      // Parse the header straight from the input unless it straddles two
+      // chunks, in which case it is collected in decoder->header.
+      if (decoder->header_length == 0 && available >= 2) {
+        status = parse_base_header(decoder, data);
+        if (status != WS_DECODE_OK)
+          return status;
+        if (available >= decoder->header_needed) {
+          status = parse_extended_header(decoder, data);
+          if (status != WS_DECODE_OK)
+            return status;
+          data += decoder->header_needed;
+          decoder->state = WS_STATE_PAYLOAD;
+          continue;
+        }
+      }
+
+      size_t n = decoder->header_needed - decoder->header_length;
+      if (n > available)
+        n = available;
+      memcpy(&decoder->header[decoder->header_length], data, n);
+      decoder->header_length += n;
+      data += n;
+      if (decoder->header_length < decoder->header_needed)
+        break;
+
+      if (decoder->header_needed == 2) {
+        status = parse_base_header(decoder, decoder->header);
+        if (status != WS_DECODE_OK)
+          return status;
+        continue;
+      }
+      status = parse_extended_header(decoder, decoder->header);
+      if (status != WS_DECODE_OK)
+        return status;
+      decoder->state = WS_STATE_PAYLOAD;
+      continue;
+    }
+
+    // A frame whose whole payload is in this chunk is unmasked in place and
+    // handed over without copying, unless it is a fragment of a message.
+    bool fragment = !decoder->fin || decoder->opcode == WS_OP_CONTINUATION;
+    if (decoder->payload_received == 0 && !fragment && decoder->payload_length <= available) {
+      size_t n = decoder->payload_length;
+      ws_unmask(data, data, n, decoder->mask, 0);
+      unsigned char *payload = data;
+      data += n;
+      status = complete_frame(decoder, payload, handler, arg);
+      if (status != WS_DECODE_OK)
+        return status;
+      continue;
+    }
+
+    if (decoder->payload_received == 0 && !(decoder->opcode & WS_CONTROL)
+        && decoder->payload_length > decoder->message_capacity - decoder->message_length)
+      return WS_CLOSE_TOO_BIG;
+
+    uint64_t remaining = decoder->payload_length - decoder->payload_received;
+    size_t n = remaining < available ? (size_t)remaining : available;
+    unsigned char *dst = payload_destination(decoder) + decoder->payload_received;
+    ws_unmask(dst, data, n, decoder->mask, decoder->payload_received);
+    decoder->payload_received += n;
+    data += n;
+
+    if (decoder->payload_received == decoder->payload_length) {
+      unsigned char *payload = decoder->opcode & WS_CONTROL ? decoder->control_buf : NULL;
+      status = complete_frame(decoder, payload, handler, arg);
+      if (status != WS_DECODE_OK)
+        return status;
+    }
+  }
+  return WS_DECODE_OK;
+}
+
+size_t ws_encode_header(unsigned char *buf, unsigned char opcode, size_t payload_length) {
+  buf[0] = WS_FIN | opcode;
+  if (payload_length < WS_PAYLOAD_LEN_16) {
+    buf[1] = payload_length;
+    return 2;
+  }
+  if (payload_length <= 0xFFFF) {
+    buf[1] = WS_PAYLOAD_LEN_16;
+    buf[2] = payload_length >> 8;
+    buf[3] = payload_length;
+    return 4;
+  }
+  buf[1] = WS_PAYLOAD_LEN_64;
+  uint64_t length = payload_length;
+  for (size_t i = 9; i >= 2; --i) {
+    buf[i] = length;
+    length >>= 8;
+  }
+  return 10;
+}
+
+void ws_accept_key(const char *key, size_t key_length, char accept[WS_ACCEPT_SIZE]) {
+  // The key and GUID are hashed without concatenating them first.
+#if WS_MBEDTLS
+  unsigned char digest[20];
+  mbedtls_sha1_context sha1;
+  mbedtls_sha1_init(&sha1);
+  mbedtls_sha1_starts(&sha1);
+  mbedtls_sha1_update(&sha1, (const unsigned char *)key, key_length);
+  mbedtls_sha1_update(&sha1, (const unsigned char *)WS_GUID, sizeof(WS_GUID) - 1);
+  mbedtls_sha1_finish(&sha1, digest);
+  mbedtls_sha1_free(&sha1);
+  // mbedTLS wants room for a terminator.
+  unsigned char encoded[WS_ACCEPT_SIZE + 1];
+  size_t encoded_length;
+  mbedtls_base64_encode(encoded, sizeof(encoded), &encoded_length, digest, sizeof(digest));
+  memcpy(accept, encoded, WS_ACCEPT_SIZE);
+#else
+  uint8_t digest[SHA1_SIZE];
+  struct Sha1 sha1;
+  sha1_init(&sha1);
+  sha1_update(&sha1, key, key_length);
+  sha1_update(&sha1, WS_GUID, sizeof(WS_GUID) - 1);
+  sha1_final(&sha1, digest);
+  base64_encode(accept, digest, sizeof(digest));
+#endif
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_FIN (1 << 7)
+#define WS_RSV 0x70
+#define WS_OPCODE 0x0F
+#define WS_CONTROL 0x08
+#define WS_MASK (1 << 7)
+#define WS_PAYLOAD_LEN 0x7F
+#define WS_PAYLOAD_LEN_16 126
+#define WS_PAYLOAD_LEN_64 127
+#define WS_OP_CONTINUATION 0x00
+#define WS_OP_TEXT 0x01
+#define WS_OP_BINARY 0x02
+#define WS_OP_CLOSE 0x08
+#define WS_OP_PING 0x09
+#define WS_OP_PONG 0x0A
+
+// Length of a Sec-WebSocket-Accept value.
+#define WS_ACCEPT_SIZE 28
+#define WS_MAX_HEADER_SIZE 14
+#define WS_MAX_CONTROL_PAYLOAD 125
+
+// Return values of ws_decode. Anything else is a close status code
+// describing why the stream was rejected.
+#define WS_DECODE_OK 0
+#define WS_DECODE_STOPPED 1
+
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_TOO_BIG 1009
+
+enum WsDecoderState {
+  WS_STATE_HEADER,
+  WS_STATE_PAYLOAD,
+};
+
+// Called for every complete message (TEXT or BINARY, reassembled from its
+// fragments) and every control frame. The payload is unmasked and stays valid
+// only for the duration of the call, and may point into the decoded input.
+// Returning false stops decoding, after which the decoder must not be used
+// again without ws_decoder_init.
+typedef bool (*ws_frame_handler)(void *arg, unsigned char opcode, unsigned char *payload, size_t length);
+
+struct WsDecoder {
+  enum WsDecoderState state;
+
+  // Header of the frame being decoded.
+  unsigned char header[WS_MAX_HEADER_SIZE];
+  size_t header_length;
+  size_t header_needed;
+  bool fin;
+  unsigned char opcode;
+  unsigned char mask[4];
+  uint64_t payload_length;
+  uint64_t payload_received;
+
+  // Message being reassembled from data frames. Control frames can arrive
+  // between its fragments and are collected separately when split.
+  unsigned char message_opcode;
+  unsigned char *message_buf;
+  size_t message_capacity;
+  size_t message_length;
+  unsigned char control_buf[WS_MAX_CONTROL_PAYLOAD];
+};
+
+void ws_decoder_init(struct WsDecoder *decoder, unsigned char *message_buf, size_t message_capacity);
+
+// Feeds the next bytes of the client stream to the decoder. Frames may be
+// split at any byte boundary across calls. Frames that arrive whole within
+// one call are unmasked in place in data, so it must be writable; only
+// fragments and frames split across calls are copied into the message buffer.
+int ws_decode(struct WsDecoder *decoder, unsigned char *data, size_t length, ws_frame_handler handler, void *arg);
+
+// Unmasks length bytes from src into dst (which may be the same buffer),
+// offset being the position of src[0] within the payload. Works a word at a
+// time where alignment allows.
+void ws_unmask(unsigned char *dst, const unsigned char *src, size_t length, const unsigned char mask[4], uint64_t offset);
+
+// Computes the Sec-WebSocket-Accept value for a Sec-WebSocket-Key, without a
+// terminator. Uses mbedTLS when built with WS_MBEDTLS, the built-in SHA-1 and
+// base64 otherwise.
+void ws_accept_key(const char *key, size_t key_length, char accept[WS_ACCEPT_SIZE]);
+
+// Writes the header of an unmasked, final server frame to buf, which must hold
+// at least WS_MAX_HEADER_SIZE bytes. Returns the header length.
+size_t ws_encode_header(unsigned char *buf, unsigned char opcode, size_t payload_length);